@@ -0,0 +1,97 @@
+#include <algorithm>
+#include <cstring>
+
+#include "ArticleView.h"
+#include "TextWidth.h"
+
+void ArticleView::setWindow(WINDOW* win){
+        window = win;
+}
+void ArticleView::setColors(chtype textAttributes, chtype positionAttributes){
+        textColor = textAttributes;
+        positionColor = positionAttributes;
+}
+// Shows text from its first line. The text is shared with the preview cache
+// and only indexed, not copied.
+void ArticleView::setText(std::shared_ptr<const std::string> newText){
+        text = std::move(newText);
+        top = 0;
+        lineStarts.clear();
+        if(text){
+                const auto data = text->data();
+                const auto size = text->size();
+                for(size_t start = 0; start < size;){
+                        lineStarts.push_back(start);
+                        const auto end = static_cast<const char*>(memchr(data + start, '\n', size - start));
+                        start = (end != nullptr) ? static_cast<size_t>(end - data) + 1 : size;
+                }
+        }
+}
+void ArticleView::clear(){
+        setText(nullptr);
+        draw();
+}
+// Moves the text by the given number of lines, down for positive ones, and
+// returns whether it moved.
+bool ArticleView::scrollLines(long lines){
+        const auto previousTop = top;
+        if(lines < 0){
+                top -= std::min(top, static_cast<size_t>(-lines));
+        }
+        else{
+                top = std::min(top + static_cast<size_t>(lines), lastTop());
+        }
+
+        if(top == previousTop){
+                return false;
+        }
+
+        draw();
+        return true;
+}
+bool ArticleView::scrollPages(long pages){
+        return scrollLines(pages * static_cast<long>(std::max<size_t>(rows() - 1, 1)));
+}
+// The text starts on the second row and column of the window; the first row
+// tells the position in articles that do not fit.
+void ArticleView::draw(){
+        if(window == nullptr){
+                return;
+        }
+
+        werase(window);
+
+        const auto width = static_cast<size_t>(getmaxx(window) - 1);
+        wattron(window, textColor);
+        for(size_t row = 0; (row < rows()) && (top + row < lineCount()); row++){
+                const auto start = lineStarts[top + row];
+                auto end = (top + row + 1 < lineCount()) ? lineStarts[top + row + 1] : text->size();
+                if((end > start) && ((*text)[end - 1] == '\n')){
+                        end--;
+                }
+
+                size_t lineWidth = 0;
+                const auto bytes = fittingBytes(text->data() + start, end - start, width, lineWidth);
+                mvwaddnstr(window, row + 1, 1, text->data() + start, bytes);
+        }
+        wattroff(window, textColor);
+
+        if(lineCount() > rows()){
+                const auto last = std::min(top + rows(), lineCount());
+                const auto position = std::to_string(top + 1) + "-" + std::to_string(last) + "/" + std::to_string(lineCount());
+                if(position.size() < width){
+                        wattron(window, positionColor);
+                        mvwaddstr(window, 0, width - position.size(), position.c_str());
+                        wattroff(window, positionColor);
+                }
+        }
+}
+size_t ArticleView::rows() const{
+        return (window != nullptr) ? static_cast<size_t>(std::max(getmaxy(window) - 1, 1)) : 1;
+}
+size_t ArticleView::lineCount() const{
+        return lineStarts.size();
+}
+size_t ArticleView::lastTop() const{
+        return (lineCount() > rows()) ? lineCount() - rows() : 0;
+}
@@ -0,0 +1,34 @@
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <curses.h>
+
+#ifndef _ARTICLE_VIEW_H_
+#define _ARTICLE_VIEW_H_
+
+// The preview window. The rendered text is indexed by line once when it is
+// shown, and only the lines in view are drawn, so scrolling through a long
+// article costs the same as through a short one.
+class ArticleView{
+        public:
+                void setWindow(WINDOW* win);
+                void setColors(chtype text, chtype position);
+                void setText(std::shared_ptr<const std::string> text);
+                void clear();
+                bool scrollLines(long lines);
+                bool scrollPages(long pages);
+                void draw();
+        private:
+                WINDOW* window{};
+                chtype textColor{}, positionColor{};
+                std::shared_ptr<const std::string> text;
+                std::vector<size_t> lineStarts;
+                size_t top{};
+
+                size_t rows() const;
+                size_t lineCount() const;
+                size_t lastTop() const;
+};
+
+#endif
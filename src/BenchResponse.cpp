@@ -0,0 +1,49 @@
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "BenchResponse.h"
+
+using namespace std::literals::string_literals;
+
+std::string generateStream(size_t entries){
+        auto body = std::ostringstream{};
+        body << "{\"id\":\"user/u/category/global.all\",\"continuation\":\"" << entries << "\",\"items\":[";
+        for(size_t i = 0; i < entries; i++){
+                auto content = "<p>"s;
+                for(size_t word = 0; word < 300; word++){
+                        content += "word" + std::to_string((i * 7 + word * 13) % 3000) + ((word % 40 == 39) ? "</p><p>" : " ");
+                }
+                content += "\\u00e9t\\u00e9 \\\"quoted\\\"</p>";
+
+                body << ((i > 0) ? "," : "")
+                        << "{\"id\":\"tag:feedly.com,2013:entry/" << i << "\","
+                        << "\"title\":\"Post " << i << ": a headline of ordinary length about something\","
+                        << "\"published\":" << 1700000000000LL + i * 60000 << ","
+                        << "\"crawled\":" << 1700000000000LL + i * 60000 + 1234 << ","
+                        << "\"origin\":{\"streamId\":\"feed/http://example.com/" << i % 40 << "\",\"title\":\"Example Feed Number " << i % 40
+                        << "\",\"htmlUrl\":\"http://example.com/\"},"
+                        << "\"alternate\":[{\"href\":\"http://example.com/" << i << ".html\",\"type\":\"text/html\"}],"
+                        << "\"categories\":[{\"id\":\"user/u/category/c" << i % 5 << "\",\"label\":\"C" << i % 5 << "\"}],"
+                        << "\"summary\":{\"direction\":\"ltr\",\"content\":\"" << content << "\"},"
+                        << "\"unread\":true,\"engagement\":" << i % 100 << "}";
+        }
+        body << "]}";
+        return body.str();
+}
+// A response dumped by debug_dump_responses starts with its URI and an empty
+// line.
+std::string readResponse(const char* path){
+        auto file = std::ifstream(path, std::ifstream::binary);
+        if(!file){
+                throw std::runtime_error("Could not open "s + path);
+        }
+
+        auto body = std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        if(!body.empty() && (body[0] != '{')){
+                if(const auto start = body.find("\n\n"); start != std::string::npos){
+                        body.erase(0, start + 2);
+                }
+        }
+        return body;
+}
@@ -0,0 +1,11 @@
+#include <string>
+
+#ifndef _BENCH_RESPONSE_H_
+#define _BENCH_RESPONSE_H_
+
+// A streams/contents response for the benchmarks: entries with about 2 kB of
+// HTML each, or one read from a file.
+std::string generateStream(size_t entries);
+std::string readResponse(const char* path);
+
+#endif
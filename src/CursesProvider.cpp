@@ -15,13 +15,16 @@
 #include <termios.h>
 #include <unistd.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <json/json.h>
 
 #include "CursesProvider.h"
+#include "HtmlRenderer.h"
 
 #define CTRLD   4
-#define POSTS_STATUSLINE "Enter: See Preview  A: mark all read  u: mark unread  r: mark read  = : change sort type s: mark saved  S: mark unsaved R: refresh  o: Open in plain-text  O: Open in Browser  F1: exit"
-#define CTG_STATUSLINE "Enter: Fetch Stream  A: mark all read  R: refresh  F1: exit"
+#define POSTS_STATUSLINE "Enter: See Preview  A: mark all read  u: mark unread  r: mark read  = : change sort type  g: group by source  s: mark saved  S: mark unsaved R: refresh  F: refresh all  o: Open in plain-text  O: Open in Browser  F1: exit"
+#define CTG_STATUSLINE "Enter: Fetch Stream  A: mark all read  R: refresh  F: refresh all  F1: exit"
 
 #define HOME_PATH getenv("HOME")
 
@@ -29,6 +32,44 @@ namespace fs = std::filesystem;
 using namespace std::literals::string_literals;
 using PipeStream = std::unique_ptr<FILE, decltype(&pclose)>;
 
+#ifdef DEBUG
+// Bytes written so far by the calling thread, which on the UI thread is the
+// terminal output. Only Linux counts them per thread.
+static unsigned long long threadBytesWritten(){
+#ifdef __linux__
+        auto io = std::ifstream("/proc/thread-self/io");
+        auto key = std::string{};
+        unsigned long long value;
+        while(io >> key >> value){
+                if(key == "wchar:"){
+                        return value;
+                }
+        }
+#endif
+        return 0;
+}
+#endif
+// Keys acting on the loaded posts, ignored while they are being replaced.
+static bool usesLoadedPosts(int ch){
+        switch(ch){
+                case 10:
+                case KEY_DOWN:
+                case KEY_UP:
+                case 'j':
+                case 'k':
+                case 'u':
+                case 'r':
+                case 's':
+                case 'S':
+                case 'o':
+                case 'O':
+                case 'g':
+                        return true;
+                default:
+                        return false;
+        }
+}
+
 CursesProvider::CursesProvider(const fs::path& tmpPath, bool verbose, bool change):
         feedly{FeedlyProvider(tmpPath)},
         previewPath{tmpPath / "preview.html"}{
@@ -46,6 +87,15 @@ CursesProvider::CursesProvider(const fs::path& tmpPath, bool verbose, bool chang
         keypad(stdscr, TRUE);
         curs_set(0);
 
+        // Keys are read by the event loop of control(), which waits for them
+        // with poll() along with the completion of background tasks.
+        nodelay(stdscr, TRUE);
+        set_escdelay(ESCAPE_DELAY_MS);
+        if(pipe(wakePipe) == 0){
+                fcntl(wakePipe[0], F_SETFL, O_NONBLOCK);
+                fcntl(wakePipe[1], F_SETFL, O_NONBLOCK);
+        }
+
         feedly.setVerbose(false);
 }
 void CursesProvider::init(){
@@ -74,6 +124,14 @@ void CursesProvider::init(){
                 currentRank = root["rank"].asBool();
                 secondsToMarkAsRead = std::chrono::seconds(root["seconds_to_mark_as_read"].asInt());
 
+                w3mPreview = (root["preview_renderer"].asString() == "w3m");
+                if(root.isMember("prerender_concurrency")){
+                        prerenderConcurrency = std::max(0, root["prerender_concurrency"].asInt());
+                }
+                if(root.isMember("preview_cache_memory_limit_mb")){
+                        previewCache.setBudget(static_cast<size_t>(std::max(0, root["preview_cache_memory_limit_mb"].asInt())) * 1024 * 1024);
+                }
+
                 if(textBrowser.empty()){
                         textBrowser = root["text_browser"].asString();
                         if(textBrowser.empty()){
@@ -99,6 +157,8 @@ void CursesProvider::init(){
         createPostsMenu();
 
         viewWin = newwin(viewWinHeight, COLS - 2, (LINES - 2 - viewWinHeight), 1);
+        articleView.setWindow(viewWin);
+        articleView.setColors(A_NORMAL, COLOR_PAIR(3));
 
         panels[0] = new_panel(ctgWin);
         panels[1] = new_panel(postsWin);
@@ -112,70 +172,77 @@ void CursesProvider::init(){
 
         top = panels[1];
         top_panel(top);
+        postsActive = true;
 
-        update_panels();
-        doupdate();
+        renderFrame();
 
-        ctgMenuCallback("All");
+        // Stored posts are shown before anything is fetched, and kept when
+        // offline.
+        showStoredPosts("All");
+        updateCategories([this](bool updated){
+                if(!updated && !postsList.empty()){
+                        return;
+                }
+
+                ctgMenuCallback("All", false, [this]{
+                        if(postsList.empty()){
+                                postsActive = false;
+                        }
+                });
+        });
 }
 void CursesProvider::control(){
         int ch;
-        MENU* curMenu;
-        if(totalPosts == 0){
-                curMenu = ctgMenu;
-        }
-        else{
-                curMenu = postsMenu;
-                changeSelectedItem(curMenu, REQ_FIRST_ITEM);
-        }
+        while((ch = nextKey()) != KEY_F(1) && ch != 'q'){
+                // The posts shown belong to a stream being replaced.
+                if(postsFrozen() && postsActive && usesLoadedPosts(ch)){
+                        continue;
+                }
 
-        while((ch = getch()) != KEY_F(1) && ch != 'q'){
-                auto curItem = current_item(curMenu);
+                const auto curCategory = current_item(ctgMenu);
+                const auto hasPost = postsActive && !postsList.empty();
                 switch(ch){
                         case 10:
-                                if((curMenu == ctgMenu) && (curItem != NULL)){
+                                if(!postsActive && (curCategory != NULL)){
                                         top = (PANEL *)panel_userptr(top);
-
-                                        update_statusline("[Updating stream]", "", false);
-
-                                        refresh();
-                                        update_panels();
-
-                                        ctgMenuCallback(item_name(curItem));
-
                                         top_panel(top);
+                                        postsActive = true;
+                                        update_statusline(NULL, "", false);
 
-                                        if(numUnread == 0){
-                                                curMenu = ctgMenu;
-                                        }
-                                        else{
-                                                curMenu = postsMenu;
-                                                update_infoline(POSTS_STATUSLINE);
-                                        }
+                                        ctgMenuCallback(item_name(curCategory), true, [this]{
+                                                // Unless the user went back to the categories meanwhile.
+                                                if(!postsActive){
+                                                        return;
+                                                }
+
+                                                if(postsList.unreadCount() == 0){
+                                                        postsActive = false;
+                                                }
+                                                else{
+                                                        update_infoline(POSTS_STATUSLINE);
+                                                }
+                                        });
                                 }
-                                else if((panel_window(top) == postsWin) && (curItem != NULL)){
-                                        postsMenuCallback(curItem, true);
+                                else if((panel_window(top) == postsWin) && hasPost){
+                                        postsMenuCallback(postsList.current(), true);
                                 }
 
                                 break;
                         case 9:
-                                if(curMenu == ctgMenu){
-                                        curMenu = postsMenu;
+                                if(!postsActive){
+                                        postsActive = true;
 
                                         renderWindow(postsWin, "Posts", 1, true);
                                         renderWindow(ctgWin, "Categories", 2, false);
 
                                         update_infoline(POSTS_STATUSLINE);
-                                        refresh();
                                 }
                                 else{
-                                        curMenu = ctgMenu;
+                                        postsActive = false;
                                         renderWindow(ctgWin, "Categories", 1, true);
                                         renderWindow(postsWin, "Posts", 2, false);
 
                                         update_infoline(CTG_STATUSLINE);
-
-                                        refresh();
                                 }
 
                                 top = (PANEL *)panel_userptr(top);
@@ -183,45 +250,70 @@ void CursesProvider::control(){
                                 break;
                         case '=':
                                 if(auto currentCategoryItem = current_item(ctgMenu)){
-                                        wclear(viewWin);
-                                        update_statusline("[Updating stream]", "", false);
-                                        refresh();
-
                                         currentRank = !currentRank;
 
+                                        // A stream loaded to its end only has to be put in
+                                        // the other order.
+                                        if(!taskRunning && !postsList.empty() &&
+                                            (postsCategory == item_name(currentCategoryItem)) && feedly.canSortLocally()){
+                                                sortPosts();
+                                                break;
+                                        }
+
+                                        articleView.clear();
                                         ctgMenuCallback(item_name(currentCategoryItem));
                                 }
 
+                                break;
+                        case 'g':
+                                // A task may be reading the stream the posts would be
+                                // rearranged in.
+                                if(taskRunning){
+                                        break;
+                                }
+
+                                groupBySource = !groupBySource;
+                                if(!postsList.empty() && feedly.canSortLocally()){
+                                        sortPosts();
+                                }
+                                else if(groupBySource && !postsList.empty()){
+                                        update_statusline("[Grouped once all posts are loaded]", NULL, true);
+                                }
+
+                                break;
+                        case KEY_RESIZE:
+                                rewrapPreviews();
                                 break;
                         case KEY_DOWN:
-                                changeSelectedItem(curMenu, REQ_DOWN_ITEM);
+                                moveCursor(1);
                                 break;
                         case KEY_UP:
-                                changeSelectedItem(curMenu, REQ_UP_ITEM);
+                                moveCursor(-1);
                                 break;
                         case 'j':
-                                changeSelectedItem(curMenu, REQ_DOWN_ITEM);
+                                moveCursor(1);
                                 break;
                         case 'k':
-                                changeSelectedItem(curMenu, REQ_UP_ITEM);
+                                moveCursor(-1);
+                                break;
+                        case KEY_NPAGE:
+                                articleView.scrollPages(1);
+                                break;
+                        case KEY_PPAGE:
+                                articleView.scrollPages(-1);
+                                break;
+                        case 'J':
+                                articleView.scrollLines(1);
+                                break;
+                        case 'K':
+                                articleView.scrollLines(-1);
                                 break;
                         case 'u':
-                                if((curMenu == postsMenu) && (curItem != NULL) && !item_opts(curItem)){
-                                        update_statusline("[Marking post unread]", NULL, true);
-                                        refresh();
-
-                                        std::string errorMessage;
-                                        try{
-                                                feedly.markPostsUnread({item_description(curItem)});
-
-                                                item_opts_on(curItem, O_SELECTABLE);
-                                                numUnread++;
-                                        }
-                                        catch(const std::exception& e){
-                                                errorMessage = e.what();
-                                        }
+                                if(hasPost && postsList.isRead(postsList.current())){
+                                        postsList.setRead(postsList.current(), false);
+                                        feedly.queueMarker(MarkerAction::Unread, std::string(feedly.getSinglePostData(postsList.current()).id));
 
-                                        update_statusline(errorMessage.c_str(), NULL, errorMessage.empty());
+                                        update_statusline("", NULL, true);
 
                                         // Prevent an article marked as unread explicitly
                                         // from being marked as read automatically.
@@ -230,63 +322,83 @@ void CursesProvider::control(){
 
                                 break;
                         case 'r':
-                                if((curMenu == postsMenu) && (curItem != NULL)){
-                                        markItemRead(curItem);
+                                if(hasPost){
+                                        markItemRead(postsList.current());
                                 }
 
                                 break;
                         case 's':
-                                if((curMenu == postsMenu) && (curItem != NULL)){
-                                        update_statusline("[Marking post saved]", NULL, true);
-                                        refresh();
-
-                                        std::string errorMessage;
-                                        try{
-                                                feedly.markPostsSaved({item_description(curItem)});
-                                        }
-                                        catch(const std::exception& e){
-                                                errorMessage = e.what();
-                                        }
-
-                                        update_statusline(errorMessage.c_str(), NULL, errorMessage.empty());
+                                if(hasPost){
+                                        feedly.queueMarker(MarkerAction::Saved, std::string(feedly.getSinglePostData(postsList.current()).id));
+                                        update_statusline("[Post saved]", NULL, true);
                                 }
 
                                 break;
                         case 'S':
-                                if((curMenu == postsMenu) && (curItem != NULL)){
-                                        update_statusline("[Marking post Unsaved]", NULL, true);
-                                        refresh();
+                                if(hasPost){
+                                        feedly.queueMarker(MarkerAction::Unsaved, std::string(feedly.getSinglePostData(postsList.current()).id));
+                                        update_statusline("[Post unsaved]", NULL, true);
+                                }
 
-                                        std::string errorMessage;
-                                        try{
-                                                feedly.markPostsUnsaved({item_description(curItem)});
-                                        }
-                                        catch(const std::exception& e){
-                                                errorMessage = e.what();
+                                break;
+                        case 'R':
+                                // The stream being loaded would be refreshed once it is
+                                // replaced, or not at all if its load is cancelled.
+                                if(postsFrozen()){
+                                        break;
+                                }
+
+                                if(auto currentCategoryItem = current_item(ctgMenu)){
+                                        // The posts shown only need to be brought up to date.
+                                        if(!postsList.empty() && (postsCategory == item_name(currentCategoryItem)) && (postsRank == currentRank)){
+                                                refreshPosts();
+                                                break;
                                         }
 
-                                        update_statusline(errorMessage.c_str(), NULL, errorMessage.empty());
+                                        articleView.clear();
+                                        ctgMenuCallback(item_name(currentCategoryItem));
                                 }
 
                                 break;
-                        case 'R':
+                        case 'F':
                                 if(auto currentCategoryItem = current_item(ctgMenu)){
-                                        wclear(viewWin);
-                                        update_statusline("[Updating stream]", "", false);
-                                        refresh();
+                                        // The loaded posts stay usable while the categories
+                                        // are fetched; they are replaced once all are in.
+                                        const auto label = std::string(item_name(currentCategoryItem));
+                                        const auto rank = currentRank;
+                                        const auto failed = std::make_shared<size_t>(0);
+                                        startTask("[Refreshing all categories]", false, [this, rank, failed]{
+                                                *failed = feedly.refreshAllStreams(rank);
+                                        }, [this, label, failed](const std::string& errorMessage, bool cancelled){
+                                                if(cancelled){
+                                                        update_statusline(errorMessage.c_str(), NULL, true);
+                                                        return;
+                                                }
 
-                                        ctgMenuCallback(item_name(currentCategoryItem));
+                                                articleView.clear();
+                                                ctgMenuCallback(label.c_str(), true, [this, errorMessage, failed]{
+                                                        if(!errorMessage.empty()){
+                                                                update_statusline(errorMessage.c_str(), NULL, false);
+                                                        }
+                                                        else if(*failed > 0){
+                                                                update_statusline(("Could not refresh " + std::to_string(*failed) + " categories").c_str(), NULL, true);
+                                                        }
+                                                        else if(!feedly.refreshesAllStreams()){
+                                                                update_statusline("[Only the unread counts are refreshed when loading ids first]", NULL, true);
+                                                        }
+                                                });
+                                        });
                                 }
 
                                 break;
                         case 'o':
-                                if((curMenu == postsMenu) && (curItem != NULL)){
-                                        postsMenuCallback(curItem, false);
+                                if(hasPost){
+                                        postsMenuCallback(postsList.current(), false);
                                 }
 
                                 break;
                         case 'O':
-                                if((curMenu == postsMenu) && (curItem != NULL)){
+                                if(hasPost){
                                         termios oldt;
                                         tcgetattr(STDIN_FILENO, &oldt);
                                         termios newt = oldt;
@@ -294,13 +406,13 @@ void CursesProvider::control(){
                                         tcsetattr(STDIN_FILENO, TCSANOW, &newt);
 
                                         try{
-                                                PostData& data = feedly.getSinglePostData(item_index(curItem));
+                                                const auto originURL = std::string(feedly.getSinglePostData(postsList.current()).originURL);
 #ifdef __APPLE__
-                                                system(std::string("open \"" + data.originURL + "\" > /dev/null &").c_str());
+                                                system(std::string("open \"" + originURL + "\" > /dev/null &").c_str());
 #else
-                                                system(std::string("xdg-open \"" + data.originURL + "\" > /dev/null &").c_str());
+                                                system(std::string("xdg-open \"" + originURL + "\" > /dev/null &").c_str());
 #endif
-                                                markItemRead(curItem);
+                                                markItemRead(postsList.current());
                                         }
                                         catch(const std::exception& e){
                                                 update_statusline(e.what(), NULL /*post*/, false /*showCounter*/);
@@ -314,6 +426,7 @@ void CursesProvider::control(){
                                         char title[200];
                                         char ctg[200];
                                         echo();
+                                        nodelay(stdscr, FALSE);
 
                                         clear_statusline();
                                         attron(COLOR_PAIR(4));
@@ -338,72 +451,261 @@ void CursesProvider::control(){
 
                                         std::vector<std::string> arrayTokens(begin, end);
 
+                                        nodelay(stdscr, TRUE);
                                         noecho();
                                         clrtoeol();
 
-                                        update_statusline("[Adding subscription]", NULL, true);
-                                        refresh();
-
-                                        std::string errorMessage;
                                         if(strlen(feed) != 0){
-                                                try{
+                                                startTask("[Adding subscription]", true, [this, feed = std::string(feed), title = std::string(title), arrayTokens]{
                                                         feedly.addSubscription(false, feed, arrayTokens, title);
-                                                }
-                                                catch(const std::exception& e){
-                                                        errorMessage = e.what();
-                                                }
+                                                }, [this](const std::string& errorMessage, bool){
+                                                        update_statusline(errorMessage.c_str(), NULL, errorMessage.empty());
+                                                });
+                                        }
+                                        else{
+                                                update_statusline("", NULL, true);
                                         }
-
-                                        update_statusline(errorMessage.c_str(), NULL, errorMessage.empty());
                                 }
 
                                 break;
                         case 'A':
                                 if(auto currentCategoryItem = current_item(ctgMenu)){
-                                        wclear(viewWin);
-                                        update_statusline("[Marking category read]", "", true);
-                                        refresh();
-
-                                        std::string errorMessage;
-                                        try{
-                                                feedly.markCategoriesRead(item_description(currentCategoryItem), lastEntryRead);
-                                        }
-                                        catch(const std::exception& e){
-                                                update_statusline(errorMessage.c_str(), NULL, errorMessage.empty());
-                                        }
+                                        articleView.clear();
+                                        postsActive = false;
+
+                                        const auto label = std::string(item_name(currentCategoryItem));
+                                        const auto id = std::string(item_description(currentCategoryItem));
+                                        startTask("[Marking category read]", true, [this, id, lastRead = lastEntryRead]{
+                                                feedly.markCategoriesRead(id, lastRead);
+                                        }, [this, label](const std::string& errorMessage, bool cancelled){
+                                                if(cancelled){
+                                                        update_statusline(errorMessage.c_str(), NULL, true);
+                                                        return;
+                                                }
 
-                                        ctgMenuCallback(item_name(currentCategoryItem));
-                                        curMenu = ctgMenu;
+                                                ctgMenuCallback(label.c_str(), false, [this, errorMessage]{
+                                                        if(!errorMessage.empty()){
+                                                                update_statusline(errorMessage.c_str(), NULL, false);
+                                                        }
+                                                });
+                                        });
                                 }
 
                                 break;
                 }
 
-                update_panels();
-                doupdate();
+                showMarkerErrors();
+                updateCategoryCounts();
+
+                renderFrame();
         }
 
-        markItemReadAutomatically(current_item(postsMenu));
+        // Whatever is still loading is of no use any more.
+        const auto postsLoaded = !postsFrozen();
+        abandonTask();
+        if(postsLoaded && !postsList.empty()){
+                markItemReadAutomatically(postsList.current());
+        }
 }
-void CursesProvider::createCategoriesMenu(){
-        clearCategoryItems();
-        try{
-                const auto& labels = feedly.getLabels();
-                ctgItems.push_back(new_item("All", labels.at("All").c_str()));
-                ctgItems.push_back(new_item("Saved", labels.at("Saved").c_str()));
-                ctgItems.push_back(new_item("Uncategorized", labels.at("Uncategorized").c_str()));
-                for(const auto& [label, id] : labels){
-                        if((label != "All") && (label != "Saved") && (label != "Uncategorized")){
-                                ctgItems.push_back(new_item(label.c_str(), id.c_str()));
+// Waits for the next key. Until one comes the screen stays alive: finished
+// background tasks are applied, timers run and the status line is redrawn.
+int CursesProvider::nextKey(){
+        // By now the previous key has been handled and painted.
+        if(keyReceived != std::chrono::steady_clock::time_point{}){
+                const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - keyReceived);
+                inputLatency.keys++;
+                inputLatency.totalTime += elapsed;
+                inputLatency.maxTime = std::max(inputLatency.maxTime, elapsed);
+                if(elapsed > INPUT_LATENCY_TARGET){
+                        inputLatency.overTarget++;
+                }
+                keyReceived = std::chrono::steady_clock::time_point{};
+                screenStats.maxKeyFlushes = std::max(screenStats.maxKeyFlushes, screenStats.keyFlushes);
+        }
+
+        while(true){
+                const auto ch = getch();
+                if(ch == CANCEL_KEY){
+                        cancelTask();
+                }
+                else if(ch != ERR){
+                        keyReceived = std::chrono::steady_clock::now();
+                        screenStats.keyFlushes = 0;
+                        return ch;
+                }
+                else{
+                        waitForEvents();
+                }
+
+                if(taskFinished){
+                        finishTask();
+                        if(!taskRunning && std::exchange(loadingDeferred, false)){
+                                resumeLoading();
                         }
                 }
+                runTimers();
+
+                renderFrame();
         }
-        catch(const std::exception& e){
-                clearCategoryItems();
-                update_statusline(e.what(), NULL /*post*/, false /*showCounter*/);
+}
+// Writes what was drawn since the last frame to the terminal in a single
+// doupdate. Drawing code only draws into windows, which ncurses tracks line by
+// line; a frame in which none of them was touched writes nothing.
+void CursesProvider::renderFrame(){
+        if(!isendwin() &&
+            !is_wintouched(stdscr) &&
+            !is_wintouched(ctgWin) &&
+            !is_wintouched(postsWin) &&
+            !is_wintouched(viewWin)){
+                screenStats.skipped++;
+                return;
+        }
+
+#ifdef DEBUG
+        const auto written = threadBytesWritten();
+#endif
+        update_panels();
+        doupdate();
+
+        screenStats.flushes++;
+        screenStats.keyFlushes++;
+#ifdef DEBUG
+        const auto bytes = threadBytesWritten() - written;
+        screenStats.bytes += bytes;
+        if(keyReceived != std::chrono::steady_clock::time_point{}){
+                screenStats.keyBytes += bytes;
+        }
+#endif
+}
+// Sleeps until a key is typed, a background task finishes or the next timer
+// is due.
+void CursesProvider::waitForEvents(){
+        const auto now = std::chrono::steady_clock::now();
+        auto timeout = std::chrono::milliseconds(taskRunning ? EVENT_LOOP_TICK : EVENT_LOOP_IDLE_TICK);
+        if((lastPostSelectionTime != std::chrono::steady_clock::time_point::max()) && (secondsToMarkAsRead >= std::chrono::seconds::zero())){
+                const auto due = lastPostSelectionTime + secondsToMarkAsRead - now;
+                timeout = std::max(std::chrono::milliseconds::zero(), std::min(timeout, std::chrono::duration_cast<std::chrono::milliseconds>(due) + std::chrono::milliseconds(1)));
+        }
+
+        struct pollfd fds[] = {{STDIN_FILENO, POLLIN, 0}, {wakePipe[0], POLLIN, 0}};
+        poll(fds, 2, timeout.count());
+
+        if(fds[1].revents & POLLIN){
+                char buffer[64];
+                while(read(wakePipe[0], buffer, sizeof(buffer)) > 0){
+                }
+        }
+}
+void CursesProvider::runTimers(){
+        const auto now = std::chrono::steady_clock::now();
+
+        if(taskRunning){
+                static const char spinner[] = {'|', '/', '-', '\\'};
+                const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - task.started);
+                const auto frame = spinner[(elapsed / EVENT_LOOP_TICK) % sizeof(spinner)];
+                const auto status = task.status + " " + frame + " " + std::to_string(elapsed.count() / 1000) + "s  Esc: cancel";
+                update_statusline(status.c_str(), NULL, true);
+        }
+
+        // Mark the post being read once it has been shown long enough.
+        if(!postsFrozen() &&
+            (now > lastPostSelectionTime) &&
+            (secondsToMarkAsRead >= std::chrono::seconds::zero()) &&
+            ((now - lastPostSelectionTime) > secondsToMarkAsRead)){
+                if(!postsList.empty()){
+                        markItemRead(postsList.current());
+                }
+                lastPostSelectionTime = std::chrono::steady_clock::time_point::max();
+        }
+
+        showMarkerErrors();
+        updateCategoryCounts();
+}
+// Runs work on a thread of its own and done on the UI thread once it is over.
+// Starting a task cancels the one in progress.
+void CursesProvider::startTask(const std::string& status, bool exclusive, std::function<void()> work, std::function<void(const std::string&, bool)> done){
+        // The done of a cancelled task may start another one.
+        while(taskRunning){
+                cancelTask();
+                finishTask();
+        }
+
+        feedly.setTransfersCancelled(false);
+        taskRunning = true;
+        taskCancelled = false;
+        taskFinished = false;
+        task.status = status;
+        task.done = std::move(done);
+        task.error = nullptr;
+        task.exclusive = exclusive;
+        task.started = std::chrono::steady_clock::now();
+        task.thread = std::thread([this, work = std::move(work)]{
+                try{
+                        work();
+                }
+                catch(const std::exception&){
+                        task.error = std::current_exception();
+                }
+
+                taskFinished = true;
+                [[maybe_unused]] const auto written = write(wakePipe[1], "", 1);
+        });
+
+        runTimers();
+}
+void CursesProvider::finishTask(){
+        task.thread.join();
+
+        // A task that completed before noticing the cancellation succeeded.
+        const auto cancelled = taskCancelled && task.error;
+        auto errorMessage = std::string{};
+        if(task.error){
+                try{
+                        std::rethrow_exception(task.error);
+                }
+                catch(const std::exception& e){
+                        errorMessage = cancelled ? "[Cancelled]" : e.what();
+                }
         }
 
-        ctgItems.push_back(NULL);
+        taskRunning = false;
+        taskCancelled = false;
+        taskFinished = false;
+        feedly.setTransfersCancelled(false);
+
+        const auto done = std::move(task.done);
+        task.done = nullptr;
+        task.error = nullptr;
+        done(errorMessage, cancelled);
+}
+// Aborts the transfers of the running task. It still finishes through the
+// event loop, with "[Cancelled]" as its error.
+void CursesProvider::cancelTask(){
+        if(taskRunning && !taskCancelled){
+                taskCancelled = true;
+                task.status = "[Cancelling]";
+                feedly.setTransfersCancelled(true);
+        }
+}
+// Stops the running task without applying its result.
+void CursesProvider::abandonTask(){
+        if(taskRunning){
+                cancelTask();
+                task.thread.join();
+                taskRunning = false;
+                taskFinished = false;
+                task.done = nullptr;
+                feedly.setTransfersCancelled(false);
+        }
+}
+bool CursesProvider::postsFrozen() const{
+        return taskRunning && task.exclusive;
+}
+// The menu starts with the categories of the last session, without counts;
+// updateCategories brings both up to date.
+void CursesProvider::createCategoriesMenu(){
+        clearCategoryItems();
+        ctgItems = categoryItems();
         ctgMenu = new_menu(ctgItems.data());
 
         const auto ctgWinHeight = LINES - 2 - viewWinHeight;
@@ -424,6 +726,130 @@ void CursesProvider::createCategoriesMenu(){
         menu_opts_on(ctgMenu, O_NONCYCLIC);
 
         post_menu(ctgMenu);
+        updateCategoryCounts();
+}
+// One item per category of the provider, NULL-terminated. The items point
+// into its labels and must be replaced whenever they change.
+std::vector<ITEM*> CursesProvider::categoryItems(){
+        const auto& labels = feedly.getLabels();
+        auto items = std::vector<ITEM*>{};
+        items.push_back(new_item("All", labels.at("All").c_str()));
+        items.push_back(new_item("Saved", labels.at("Saved").c_str()));
+        items.push_back(new_item("Uncategorized", labels.at("Uncategorized").c_str()));
+        for(const auto& [label, id] : labels){
+                if((label != "All") && (label != "Saved") && (label != "Uncategorized")){
+                        items.push_back(new_item(label.c_str(), id.c_str()));
+                }
+        }
+        items.push_back(NULL);
+
+        return items;
+}
+// Fetches the categories and their unread counts in the background, then
+// rebuilds the menu with them and runs then, unless it was cancelled, with
+// whether they came.
+void CursesProvider::updateCategories(std::function<void(bool updated)> then){
+        const auto labels = std::make_shared<std::map<std::string, std::string>>();
+        const auto countsError = std::make_shared<std::string>();
+        startTask("[Updating categories]", false, [this, labels, countsError]{
+                *labels = feedly.fetchLabels();
+
+                // The menu is still usable without counts.
+                try{
+                        feedly.fetchUnreadCounts();
+                }
+                catch(const std::exception& e){
+                        *countsError = e.what();
+                }
+        }, [this, labels, countsError, then](const std::string& errorMessage, bool cancelled){
+                if(cancelled){
+                        return;
+                }
+
+                if(errorMessage.empty()){
+                        replaceCategoryItems(std::move(*labels));
+                }
+                const auto& message = errorMessage.empty() ? *countsError : errorMessage;
+                if(!message.empty()){
+                        update_statusline(message.c_str(), NULL /*post*/, false /*showCounter*/);
+                }
+
+                if(then){
+                        then(errorMessage.empty());
+                }
+        });
+}
+// Gives the provider new labels and the menu items for them, staying on the
+// current category if it is still there.
+void CursesProvider::replaceCategoryItems(std::map<std::string, std::string>&& labels){
+        const auto current = current_item(ctgMenu);
+        const auto currentLabel = (current != NULL) ? std::string(item_name(current)) : std::string{};
+
+        unpost_menu(ctgMenu);
+        feedly.setLabels(std::move(labels));
+        auto items = categoryItems();
+        set_menu_items(ctgMenu, items.data());
+        clearCategoryItems();
+        ctgItems = std::move(items);
+
+        for(const auto item : ctgItems){
+                if((item != NULL) && (currentLabel == item_name(item))){
+                        set_current_item(ctgMenu, item);
+                        break;
+                }
+        }
+
+        post_menu(ctgMenu);
+        shownCounts.clear();
+        updateCategoryCounts();
+}
+// Greys out the categories with nothing unread and prints the unread count
+// at the right of each visible category.
+void CursesProvider::updateCategoryCounts(){
+        for(const auto item : ctgItems){
+                if(item == NULL){
+                        continue;
+                }
+
+                const auto hasUnread = (feedly.getUnreadCount(item_name(item)) != 0);
+                if(hasUnread != static_cast<bool>(item_opts(item) & O_SELECTABLE)){
+                        if(hasUnread){
+                                item_opts_on(item, O_SELECTABLE);
+                        }
+                        else{
+                                item_opts_off(item, O_SELECTABLE);
+                        }
+                }
+        }
+
+        int rows, columns;
+        menu_format(ctgMenu, &rows, &columns);
+        const auto width = getmaxx(ctgMenuWin);
+        const auto top = top_row(ctgMenu);
+
+        auto counts = std::vector<int>{};
+        for(int row = 0; (row < rows) && (top + row < item_count(ctgMenu)); row++){
+                counts.push_back(feedly.getUnreadCount(item_name(ctgItems.at(top + row))));
+        }
+
+        // Counts are drawn again only when they changed or the menu was
+        // painted over them.
+        if((counts == shownCounts) && !is_wintouched(ctgWin)){
+                return;
+        }
+
+        wattron(ctgMenuWin, COLOR_PAIR(3));
+        for(size_t row = 0; row < counts.size(); row++){
+                if(counts[row] >= 0){
+                        char text[16];
+                        snprintf(text, sizeof(text), "%6d", counts[row]);
+                        mvwaddstr(ctgMenuWin, row, width - strlen(text), text);
+                }
+        }
+        wattroff(ctgMenuWin, COLOR_PAIR(3));
+        wsyncup(ctgMenuWin);
+
+        shownCounts = std::move(counts);
 }
 void CursesProvider::createPostsMenu(){
         const auto height = LINES - 2 - viewWinHeight;
@@ -433,120 +859,549 @@ void CursesProvider::createPostsMenu(){
         const auto width = getmaxx(postsWin);
         postsMenuWin = derwin(postsWin, height - 4, width - 2, 3, 1);
 
-        postsMenu = new_menu(NULL);
-        set_menu_win(postsMenu, postsWin);
-        set_menu_sub(postsMenu, postsMenuWin);
-        set_menu_fore(postsMenu, COLOR_PAIR(7) | A_REVERSE);
-        set_menu_back(postsMenu, COLOR_PAIR(6));
-        set_menu_grey(postsMenu, COLOR_PAIR(8));
-        set_menu_mark(postsMenu, "*");
+        postsList.setWindow(postsMenuWin);
+        postsList.setColors(COLOR_PAIR(7) | A_REVERSE, COLOR_PAIR(6), COLOR_PAIR(8));
 
         renderWindow(postsWin, "Posts", 1, true);
+}
+// Loads a category into the posts menu in the background, then runs then.
+void CursesProvider::ctgMenuCallback(const char* label, bool usePrefetched, std::function<void()> then){
+        if(!postsFrozen() && !postsList.empty()){
+                markItemReadAutomatically(postsList.current());
+        }
+        lastPostSelectionTime = std::chrono::steady_clock::time_point::max();
+
+        const auto category = std::string(label);
+        const auto rank = currentRank;
+        const auto posts = std::make_shared<const std::vector<PostHandle>*>();
+        startTask("[Updating stream]", true, [this, category, rank, usePrefetched, posts]{
+                // Send pending markers first, so the new stream reflects them.
+                feedly.flushMarkers();
+
+                *posts = &feedly.giveStreamPosts(category, rank, usePrefetched);
+        }, [this, category, rank, posts, then](const std::string& errorMessage, bool){
+                if(errorMessage.empty() && groupBySource && feedly.canSortLocally()){
+                        feedly.sortPosts(rank, true);
+                }
+                populatePostsMenu(errorMessage.empty() ? *posts : nullptr);
+                postsCategory = errorMessage.empty() ? category : "";
+                postsRank = rank;
+
+                update_statusline(errorMessage.c_str(), NULL, errorMessage.empty());
+                renderWindow(postsWin, "Posts", 1, true);
+                renderWindow(ctgWin, "Categories", 2, false);
 
-        menu_opts_off(postsMenu, O_SHOWDESC);
+                prefetchNeighbours();
 
-        post_menu(postsMenu);
+                if(!postsList.empty()){
+                        lastEntryRead = feedly.getSinglePostData(0).id;
+                        selectPost(0, true);
+                }
+                else
+                {
+                        printPostMenuMessage("All Posts Read");
+                        articleView.clear();
+                }
+
+                if(then){
+                        then();
+                }
+        });
 }
-void CursesProvider::ctgMenuCallback(const char* label){
-        markItemReadAutomatically(current_item(postsMenu));
+// Refreshes the loaded stream in the background. Only the new posts are
+// fetched whole; those still unread keep their row, read state and preview,
+// and the cursor stays on the post it was on.
+void CursesProvider::refreshPosts(){
+        if(!postsFrozen()){
+                markItemReadAutomatically(postsList.current());
+        }
+        lastPostSelectionTime = std::chrono::steady_clock::time_point::max();
+
+        const auto changes = std::make_shared<StreamChanges>();
+        startTask("[Refreshing stream]", true, [this, changes]{
+                // Posts read here must not come back as unread.
+                feedly.flushMarkers();
+
+                *changes = feedly.fetchStreamChanges();
+        }, [this, changes](const std::string& errorMessage, bool cancelled){
+                if(!errorMessage.empty()){
+                        update_statusline(errorMessage.c_str(), NULL, cancelled);
+                        return;
+                }
 
-        int startx, height, width;
-        [[maybe_unused]] int starty;
+                const auto previousId = postsList.empty() ? std::string{} : std::string(feedly.getSinglePostData(postsList.current()).id);
+                const auto previous = feedly.applyStreamChanges(std::move(*changes));
+                postsList.replace(previous);
 
-        getmaxyx(postsWin, height, width);
-        getbegyx(postsWin, starty, startx);
+                reindexPreviews(previous);
+                auto jobs = std::map<size_t, PreviewJob>{};
+                for(size_t i = 0; i < previous.size(); i++){
+                        const auto post = feedly.getSinglePostData(i);
+                        if((previous[i] == NEW_POST_INDEX) && !post.partial){
+                                jobs.emplace(i, PreviewJob{std::string(post.id), feedly.getPackedPostContent(i)});
+                        }
+                }
+                queuePreviews(std::move(jobs), false);
 
-        std::string errorMessage;
-        clearPostItems();
-        try{
-                const auto& posts = feedly.giveStreamPosts(label, currentRank);
-                for(const auto& post : posts){
-                        postsItems.push_back(new_item(post.title.c_str(), post.id.c_str()));
+                // The stream comes in the order of its rank.
+                groupPosts();
+
+                update_statusline("", NULL, true);
+                prefetchNeighbours();
+
+                if(postsList.empty()){
+                        printPostMenuMessage("All Posts Read");
+                        articleView.clear();
+                        return;
                 }
-        }
-        catch(const std::exception& e){
-                clearPostItems();
-                errorMessage = e.what();
+
+                lastEntryRead = feedly.getSinglePostData(0).id;
+                if(feedly.getSinglePostData(postsList.current()).id != previousId){
+                        selectPost(postsList.current(), true);
+                }
+                else{
+                        lastPostSelectionTime = std::chrono::steady_clock::now();
+                }
+        });
+}
+// Puts the loaded posts in time order for the current rank, grouped by source
+// if asked for; the cursor, read marks and pending previews stay with their
+// posts.
+void CursesProvider::sortPosts(){
+        const auto previous = feedly.sortPosts(currentRank, groupBySource);
+        postsRank = currentRank;
+        postsList.replace(previous);
+
+        reindexPreviews(previous);
+        prioritisePreviews(postsList.current());
+}
+// Groups the loaded posts by source when asked for, once the whole stream is
+// in; a part of it would not keep its order as the next pages come. Returns
+// whether the posts were put in order.
+bool CursesProvider::groupPosts(){
+        if(!groupBySource || !feedly.canSortLocally()){
+                return false;
         }
 
-        totalPosts = postsItems.size();
-        numUnread = totalPosts;
-        printPostMenuMessage("");
+        sortPosts();
+        return true;
+}
+// Paint the posts kept from the last session while the stream is being fetched.
+void CursesProvider::showStoredPosts(const char* label){
+        const auto& posts = feedly.giveStoredPosts(label, currentRank);
+        if(posts.empty()){
+                return;
+        }
 
-        postsItems.push_back(NULL);
-        unpost_menu(postsMenu);
-        set_menu_items(postsMenu, postsItems.data());
-        set_menu_format(postsMenu, height - 4, 0);
-        post_menu(postsMenu);
+        populatePostsMenu(&posts);
 
-        update_statusline(errorMessage.c_str(), NULL, errorMessage.empty());
+        update_statusline("[Updating stream]", NULL, true);
         renderWindow(postsWin, "Posts", 1, true);
-        renderWindow(ctgWin, "Categories", 2, false);
 
-        if(totalPosts > 0){
-                lastEntryRead = item_description(postsItems.at(0));
-                changeSelectedItem(postsMenu, REQ_FIRST_ITEM);
-        }
-        else
-        {
-                printPostMenuMessage("All Posts Read");
-                wclear(viewWin);
-        }
+        renderFrame();
+}
+// Shows the posts of a stream, or none without one. The list reads them from
+// the post store, which belongs to the FeedlyProvider and outlives it.
+void CursesProvider::populatePostsMenu(const std::vector<PostHandle>* posts){
+        postsList.setPosts(&feedly.getPostStore(), posts);
+
+        queueLoadedPreviews();
+
+        postsList.draw();
 }
 void CursesProvider::changeSelectedItem(MENU* curMenu, int req){
         ITEM* previousItem = current_item(curMenu);
         menu_driver(curMenu, req);
         ITEM* curItem = current_item(curMenu);
 
-        if((curMenu != postsMenu) ||
-            !curItem ||
-            ((previousItem == curItem) && (req != REQ_FIRST_ITEM))){
+        if(previousItem != curItem){
+                prefetchNeighbours();
+        }
+}
+// Moves the cursor of the focused menu one row down or up.
+void CursesProvider::moveCursor(int direction){
+        if(!postsActive){
+                changeSelectedItem(ctgMenu, (direction > 0) ? REQ_DOWN_ITEM : REQ_UP_ITEM);
+        }
+        else if(!postsList.empty() && ((direction > 0) || (postsList.current() > 0))){
+                selectPost(postsList.current() + direction);
+        }
+}
+// Moves the cursor of the posts list and previews the post it lands on. With
+// force the post is previewed even if the cursor was on it already.
+void CursesProvider::selectPost(size_t index, bool force){
+        const auto previous = postsList.current();
+        const auto moved = postsList.select(index);
+        const auto current = postsList.current();
+
+        if(!postsList.empty() &&
+            ((current + LOAD_MORE_MARGIN) >= postsList.size()) &&
+            feedly.hasMorePosts()){
+                loadMorePosts();
+
+                // Moving past the last loaded post continues into the new
+                // page once it arrives.
+                if(index >= postsList.size()){
+                        moveDownAfterLoad = true;
+                }
+        }
+
+        if(postsList.empty() || (!moved && !force)){
                 return;
         }
 
-        markItemReadAutomatically(previousItem);
+        markItemReadAutomatically(previous);
 
+        loadPostWindow(current);
+        prioritisePreviews(current);
+        showPreview(current);
+}
+// Shows the preview of the post at index and its title in the status line.
+void CursesProvider::showPreview(size_t index){
         try{
-                const auto& postData = feedly.getSinglePostData(item_index(curItem));
-                if(auto myfile = std::ofstream(previewPath.c_str())){
-                        myfile << postData.content;
-                }
-
-                std::string content;
-                char buffer[256];
-                const auto command = "w3m -dump -cols " + std::to_string(COLS - 2) + " " + previewPath.native();
-                if(const auto stream = PipeStream(popen(command.c_str(), "r"), &pclose)){
-                        while(!feof(stream.get())){
-                                if(fgets(buffer, 256, stream.get()) != NULL){
-                                        content.append(buffer);
-                                }
+                const auto postData = feedly.getSinglePostData(index);
+
+                const auto started = std::chrono::steady_clock::now();
+                const auto content = previewText(index);
+                const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started);
+                previewStats.count++;
+                previewStats.totalTime += elapsed;
+                previewStats.maxTime = std::max(previewStats.maxTime, elapsed);
+
+                articleView.setText(content);
+                articleView.draw();
+                update_statusline(NULL, (std::string(postData.originTitle) + " - " + std::string(postData.title)).c_str(), true);
+        }
+        catch (const std::exception& e){
+                update_statusline(e.what(), NULL /*post*/, false /*showCounter*/);
+        }
+}
+// Returns the preview of a post for the current width of the preview window,
+// rendering it only if it is not cached yet.
+std::shared_ptr<const std::string> CursesProvider::previewText(size_t index){
+        const auto postData = feedly.getSinglePostData(index);
+        const auto columns = static_cast<size_t>(getmaxx(viewWin) - 1);
+        if(postData.partial){
+                return std::make_shared<const std::string>();
+        }
+        const auto id = std::string(postData.id);
+        if(auto cached = previewCache.find(id, columns)){
+                return cached;
+        }
+
+        auto content = std::make_shared<const std::string>(renderPreview(feedly.getPostContent(index), columns));
+        previewCache.insert(id, columns, content);
+        return content;
+}
+// Returns the content of a post as plain text for the preview window, either
+// from the built-in renderer or, if configured, from w3m.
+std::string CursesProvider::renderPreview(const std::string& html, size_t columns){
+        if(!w3mPreview){
+                return HtmlRenderer(columns).render(html);
+        }
+
+        if(auto myfile = std::ofstream(previewPath.c_str())){
+                myfile << html;
+        }
+
+        std::string content;
+        char buffer[256];
+        const auto command = "w3m -dump -cols " + std::to_string(columns) + " " + previewPath.native();
+        if(const auto stream = PipeStream(popen(command.c_str(), "r"), &pclose)){
+                while(!feof(stream.get())){
+                        if(fgets(buffer, 256, stream.get()) != NULL){
+                                content.append(buffer);
                         }
                 }
+        }
+
+        return content;
+}
+// Queue the previews of all loaded posts in place of the pending ones.
+void CursesProvider::queueLoadedPreviews(){
+        auto jobs = std::map<size_t, PreviewJob>{};
+        for(size_t i = 0; i < postsList.size(); i++){
+                const auto post = feedly.getSinglePostData(i);
+                if(!post.partial){
+                        jobs.emplace(i, PreviewJob{std::string(post.id), feedly.getPackedPostContent(i)});
+                }
+        }
+        queuePreviews(std::move(jobs), true);
+}
+// Hand the previews of loaded posts to the background renderers. With replace
+// the previous stream's pending jobs are dropped.
+void CursesProvider::queuePreviews(std::map<size_t, PreviewJob>&& jobs, bool replace){
+        // w3m goes through a single preview file and a fork, so it is only run
+        // for the post under the cursor.
+        if(w3mPreview || prerenderConcurrency == 0){
+                return;
+        }
+
+        {
+                auto lock = std::lock_guard(prerenderMutex);
+                if(replace){
+                        prerenderJobs.clear();
+                        prerenderCursor = 0;
+                }
+                prerenderJobs.merge(jobs);
+                prerenderColumns = static_cast<size_t>(getmaxx(viewWin) - 1);
+                prerenderCacheFull = false;
+        }
 
-                wclear(viewWin);
-                mvwprintw(viewWin, 1, 1, content.c_str());
-                wrefresh(viewWin);
-                update_statusline(NULL, (postData.originTitle + " - " + postData.title).c_str(), true);
+        while(prerenderWorkers.size() < prerenderConcurrency){
+                prerenderWorkers.emplace_back(&CursesProvider::prerenderWorker, this);
+        }
 
-                update_panels();
+        prerenderCondition.notify_all();
+}
+// Render the posts nearest to the cursor first.
+void CursesProvider::prioritisePreviews(size_t cursor){
+        {
+                auto lock = std::lock_guard(prerenderMutex);
+                prerenderCursor = cursor;
+                prerenderCacheFull = false;
         }
-        catch (const std::exception& e){
-                update_statusline(e.what(), NULL /*post*/, false /*showCounter*/);
+        prerenderCondition.notify_all();
+}
+// Moves the pending previews to the indices their posts have after a
+// refresh, dropping those of the posts that are gone.
+void CursesProvider::reindexPreviews(const std::vector<size_t>& previous){
+        auto lock = std::lock_guard(prerenderMutex);
+        if(prerenderJobs.empty()){
+                return;
         }
+
+        auto jobs = std::map<size_t, PreviewJob>{};
+        for(size_t i = 0; i < previous.size(); i++){
+                if(const auto it = prerenderJobs.find(previous[i]); it != prerenderJobs.end()){
+                        jobs.emplace(i, std::move(it->second));
+                }
+        }
+        prerenderJobs = std::move(jobs);
+}
+// Previews are wrapped for the width of the preview window: the cached and
+// pending ones are dropped, those of the loaded posts queued again at the new
+// width, and the one shown rendered again. While a stream is being replaced,
+// its previews are queued once it is in.
+void CursesProvider::rewrapPreviews(){
+        {
+                auto lock = std::lock_guard(prerenderMutex);
+                previewCache.clear();
+                prerenderJobs.clear();
+                prerenderColumns = static_cast<size_t>(getmaxx(viewWin) - 1);
+                prerenderCacheFull = false;
+        }
+
+        if(postsFrozen() || postsList.empty()){
+                return;
+        }
+
+        queueLoadedPreviews();
+        prioritisePreviews(postsList.current());
+
+        showPreview(postsList.current());
 }
-void CursesProvider::postsMenuCallback(ITEM* item, bool preview){
+void CursesProvider::prerenderWorker(){
+        auto lock = std::unique_lock(prerenderMutex);
+        while(true){
+                prerenderCondition.wait(lock, [this]{
+                        return stopPrerender || (!prerenderJobs.empty() && !prerenderCacheFull);
+                });
+                if(stopPrerender){
+                        break;
+                }
+
+                // The job nearest to the cursor is either the first one at or
+                // after it, or the one right before.
+                auto it = prerenderJobs.lower_bound(prerenderCursor);
+                if(it == prerenderJobs.end() ||
+                    ((it != prerenderJobs.begin()) && (prerenderCursor - std::prev(it)->first < it->first - prerenderCursor))){
+                        it = std::prev(it);
+                }
+
+                const auto index = it->first;
+                auto job = std::move(it->second);
+                prerenderJobs.erase(it);
+                const auto columns = prerenderColumns;
+                lock.unlock();
+
+                auto text = std::shared_ptr<const std::string>{};
+                if(!previewCache.contains(job.id, columns)){
+                        const auto html = feedly.getPostStore().unpack(job.content);
+                        text = std::make_shared<const std::string>(HtmlRenderer(columns).render(html));
+                }
+
+                lock.lock();
+
+                // Rendered for a width the preview window no longer has.
+                if(columns != prerenderColumns){
+                        continue;
+                }
+
+                // Previews rendered ahead never push out ones already cached;
+                // the worker waits for the cursor to move instead.
+                const auto stored = !text || previewCache.insert(job.id, columns, std::move(text), false);
+                if(stored){
+                        previewStats.prerendered++;
+                }
+                else{
+                        prerenderJobs.emplace(index, std::move(job));
+                        prerenderCacheFull = true;
+                }
+        }
+}
+void CursesProvider::stopPrerenderWorkers(){
+        {
+                auto lock = std::lock_guard(prerenderMutex);
+                stopPrerender = true;
+        }
+        prerenderCondition.notify_all();
+
+        for(auto& worker : prerenderWorkers){
+                worker.join();
+        }
+        prerenderWorkers.clear();
+}
+// Fetch the categories above and below the cursor in the background, so that
+// opening them does not have to wait for the network.
+void CursesProvider::prefetchNeighbours(){
+        const auto curItem = current_item(ctgMenu);
+        if(curItem == NULL){
+                return;
+        }
+
+        const auto index = item_index(curItem);
+        auto categories = std::vector<std::string>{};
+        for(const auto neighbour : {index - 1, index + 1}){
+                // Nothing to fetch from a category known to have no unread posts.
+                if((neighbour >= 0) && (neighbour < item_count(ctgMenu)) &&
+                    (feedly.getUnreadCount(item_name(ctgItems.at(neighbour))) != 0)){
+                        categories.push_back(item_name(ctgItems.at(neighbour)));
+                }
+        }
+
+        feedly.prefetchStreams(categories, currentRank);
+}
+// Fetch the bodies of the posts around the cursor that only have an id yet
+// in the background, and show their titles once they are in. While another
+// task runs, this waits for it to finish.
+void CursesProvider::loadPostWindow(size_t index){
+        const auto ids = std::make_shared<std::vector<std::string>>(feedly.partialPostsAround(index));
+        if(ids->empty()){
+                return;
+        }
+        if(taskRunning){
+                loadingDeferred = true;
+                return;
+        }
+
+        const auto loaded = std::make_shared<std::map<std::string, PostData>>();
+        startTask("[Loading posts]", false, [this, ids, loaded]{
+                *loaded = feedly.fetchPosts(*ids);
+        }, [this, ids, loaded](const std::string& errorMessage, bool cancelled){
+                if(!errorMessage.empty()){
+                        update_statusline(errorMessage.c_str(), NULL /*post*/, cancelled /*showCounter*/);
+                        return;
+                }
+
+                const auto completed = feedly.completePosts(*ids, std::move(*loaded));
+                auto jobs = std::map<size_t, PreviewJob>{};
+                for(const auto i : completed){
+                        const auto post = feedly.getSinglePostData(i);
+                        jobs.emplace(i, PreviewJob{std::string(post.id), feedly.getPackedPostContent(i)});
+                }
+                queuePreviews(std::move(jobs), false);
+
+                // The post under the cursor may have been one of them.
+                const auto current = std::find(completed.begin(), completed.end(), postsList.current()) != completed.end();
+
+                // The last posts with only an id may have completed the stream.
+                if(!groupPosts()){
+                        postsList.draw();
+                }
+
+                update_statusline("", NULL /*post*/, true /*showCounter*/);
+
+                if(current){
+                        showPreview(postsList.current());
+                }
+        });
+}
+// Starts the loading that waited for a task: the bodies around the cursor,
+// then the next page when the cursor is near the end.
+void CursesProvider::resumeLoading(){
+        if(postsList.empty()){
+                return;
+        }
+
+        loadPostWindow(postsList.current());
+        if(((postsList.current() + LOAD_MORE_MARGIN) >= postsList.size()) && feedly.hasMorePosts()){
+                loadMorePosts();
+        }
+}
+// Fetch the next page of the current stream in the background and append it
+// to the posts menu. The loaded posts can be read meanwhile.
+void CursesProvider::loadMorePosts(){
+        if(taskRunning){
+                loadingDeferred = true;
+                return;
+        }
+
+        const auto page = std::make_shared<StreamPage>();
+        startTask("[Loading more posts]", false, [this, page]{
+                *page = feedly.fetchMorePosts();
+        }, [this, page](const std::string& errorMessage, bool cancelled){
+                appendPostItems(std::move(*page), errorMessage, cancelled);
+        });
+}
+void CursesProvider::appendPostItems(StreamPage&& page, const std::string& errorMessage, bool cancelled){
+        const auto moveDown = std::exchange(moveDownAfterLoad, false);
+
+        // A cancelled page is fetched again when the cursor next moves, while
+        // a failed one leaves the stream without continuation and ends it.
+        if(cancelled){
+                update_statusline(errorMessage.c_str(), NULL, true);
+                return;
+        }
+
+        const auto previousSize = postsList.size();
+        const auto added = feedly.appendPosts(std::move(page));
+        if(added > 0){
+                auto jobs = std::map<size_t, PreviewJob>{};
+                for(size_t i = previousSize; i < previousSize + added; i++){
+                        const auto post = feedly.getSinglePostData(i);
+                        if(!post.partial){
+                                jobs.emplace(i, PreviewJob{std::string(post.id), feedly.getPackedPostContent(i)});
+                        }
+                }
+                queuePreviews(std::move(jobs), false);
+
+                postsList.append(added);
+                if(!groupPosts()){
+                        postsList.draw();
+                }
+        }
+
+        update_statusline(errorMessage.c_str(), NULL, errorMessage.empty());
+
+        // Grouped by source, the new posts are not below the cursor.
+        if(moveDown && !(groupBySource && feedly.canSortLocally()) && (added > 0) && postsActive && (postsList.current() + 1 == previousSize)){
+                selectPost(previousSize);
+        }
+}
+void CursesProvider::postsMenuCallback(size_t index, bool preview){
         auto command = std::string{};
         try{
-                const auto& postData = feedly.getSinglePostData(item_index(item));
+                const auto postData = feedly.getSinglePostData(index);
                 if(preview){
                         if(auto myfile = std::ofstream(previewPath.c_str())){
-                                myfile << postData.content;
+                                myfile << feedly.getPostContent(index);
                         }
 
                         command = "w3m " + previewPath.native();
                 }
                 else{
-                        command = textBrowser + " \'" + postData.originURL + "\'";
+                        command = textBrowser + " \'" + std::string(postData.originURL) + "\'";
                 }
 
         }
@@ -561,8 +1416,8 @@ void CursesProvider::postsMenuCallback(ITEM* item, bool preview){
         reset_prog_mode();
 
         if(exitCode == 0){
-                markItemRead(item);
-                lastEntryRead = item_description(item);
+                markItemRead(index);
+                lastEntryRead = feedly.getSinglePostData(index).id;
         }
         else{
                 const auto updateStatus = preview ? "Failed to preview the post" : "Failed to open the post";
@@ -574,34 +1429,37 @@ void CursesProvider::postsMenuCallback(ITEM* item, bool preview){
                 fs::remove(previewPath, errorCode);
         }
 }
-void CursesProvider::markItemRead(ITEM* item){
-        if(item_opts(item)){
-                item_opts_off(item, O_SELECTABLE);
-                update_statusline("[Marking post read]", NULL, true);
-                refresh();
+// The post is greyed out right away; the marker is sent in the background.
+void CursesProvider::markItemRead(size_t index){
+        if(!postsList.isRead(index)){
+                postsList.setRead(index, true);
 
                 std::string errorMessage;
                 try{
-                        const auto& postData = feedly.getSinglePostData(item_index(item));
-                        feedly.markPostsRead({postData.id});
-                        numUnread--;
+                        const auto postData = feedly.getSinglePostData(index);
+                        feedly.queueMarker(MarkerAction::Read, std::string(postData.id));
                 }
                 catch (const std::exception& e){
                         errorMessage = e.what();
                 }
 
                 update_statusline(errorMessage.c_str(), NULL, errorMessage.empty());
-                update_panels();
+        }
+}
+// Show markers that failed to be sent since the last key press.
+void CursesProvider::showMarkerErrors(){
+        const auto errors = feedly.takeMarkerErrors();
+        if(!errors.empty()){
+                update_statusline(errors.back().c_str(), NULL, false);
         }
 }
 // Mark an article as read if it has been shown for more than a certain period of time.
-void CursesProvider::markItemReadAutomatically(ITEM* item){
+void CursesProvider::markItemReadAutomatically(size_t index){
         const auto now = std::chrono::steady_clock::now();
-        if ((item != NULL) &&
-            (now > lastPostSelectionTime) &&
+        if ((now > lastPostSelectionTime) &&
             (secondsToMarkAsRead >= std::chrono::seconds::zero()) &&
             ((now - lastPostSelectionTime) > secondsToMarkAsRead)){
-                markItemRead(item);
+                markItemRead(index);
         }
 
         lastPostSelectionTime = now;
@@ -666,10 +1524,12 @@ void CursesProvider::printPostMenuMessage(const std::string& message){
         wattron(postsMenuWin, 1);
         mvwprintw(postsMenuWin, y, x, message.c_str());
         wattroff(postsMenuWin, 1);
+        wsyncup(postsMenuWin);
 }
 void CursesProvider::clear_statusline(){
         move(LINES-2, 0);
         clrtoeol();
+        shownStatusLine.clear();
 }
 void CursesProvider::update_statusline(const char* update, const char* post, bool showCounter){
         if (update != NULL)
@@ -677,17 +1537,23 @@ void CursesProvider::update_statusline(const char* update, const char* post, boo
         if (post != NULL)
                 statusLine[1] = std::string(post);
         if (showCounter) {
-                const auto numRead = totalPosts - numUnread;
+                const auto numUnread = postsList.unreadCount();
+                const auto numRead = postsList.size() - numUnread;
                 std::stringstream sstm;
-                sstm << "[" << numUnread << ":" << numRead << "/" << totalPosts << "]";
+                sstm << "[" << numUnread << ":" << numRead << "/" << postsList.size() << "]";
                 statusLine[2] = sstm.str();
         } else {
                 statusLine[2] = std::string();
         }
 
+        // Most updates, such as those of the timers, leave the line as it is.
+        auto line = statusLine[0] + '\n' + statusLine[1] + '\n' + statusLine[2];
+        if(line == shownStatusLine){
+                return;
+        }
+
         clear_statusline();
-        move(LINES - 2, 0);
-        clrtoeol();
+        shownStatusLine = std::move(line);
         attron(COLOR_PAIR(1));
         mvprintw(LINES - 2, 0, statusLine[0].c_str());
         attroff(COLOR_PAIR(1));
@@ -696,8 +1562,6 @@ void CursesProvider::update_statusline(const char* update, const char* post, boo
         attron(COLOR_PAIR(3));
         mvprintw(LINES - 2, COLS - statusLine[2].length(), statusLine[2].c_str());
         attroff(COLOR_PAIR(3));
-        refresh();
-        update_panels();
 }
 void CursesProvider::update_infoline(const char* info){
         move(LINES-1, 0);
@@ -715,28 +1579,57 @@ void CursesProvider::clearCategoryItems(){
 
         ctgItems.clear();
 }
-void CursesProvider::clearPostItems(){
-        for(const auto& postItem : postsItems){
-                if(postItem != NULL){
-                        free_item(postItem);
-                }
-        }
-
-        postsItems.clear();
-}
 CursesProvider::~CursesProvider(){
+        abandonTask();
+        stopPrerenderWorkers();
+
         if(ctgMenu != NULL){
                 unpost_menu(ctgMenu);
                 free_menu(ctgMenu);
         }
 
-        if(postsMenu != NULL){
-                unpost_menu(postsMenu);
-                free_menu(postsMenu);
-        }
-
         clearCategoryItems();
-        clearPostItems();
         endwin();
+
+        for(const auto fd : wakePipe){
+                if(fd >= 0){
+                        close(fd);
+                }
+        }
+
+#ifdef DEBUG
+        if(inputLatency.keys > 0){
+                feedly.logMessage("Input: "s + std::to_string(inputLatency.keys) + " keys painted in " +
+                    std::to_string(inputLatency.totalTime.count() / inputLatency.keys) + " us average, " +
+                    std::to_string(inputLatency.maxTime.count()) + " us max, " +
+                    std::to_string(inputLatency.overTarget) + " over the " +
+                    std::to_string(INPUT_LATENCY_TARGET.count()) + " ms target");
+        }
+
+        if(screenStats.flushes > 0){
+                const auto keys = std::max(inputLatency.keys, 1UL);
+                feedly.logMessage("Screen: "s + std::to_string(screenStats.flushes) + " flushes, " +
+                    std::to_string(screenStats.skipped) + " idle frames skipped, at most " +
+                    std::to_string(screenStats.maxKeyFlushes) + " per key, " +
+                    std::to_string(screenStats.bytes) + " bytes written, " +
+                    std::to_string(screenStats.keyBytes / keys) + " per key");
+        }
+
+        if(previewStats.count > 0){
+                feedly.logMessage("Previews: "s + std::to_string(previewStats.count) + " shown, " +
+                    std::to_string(previewStats.prerendered) + " rendered ahead, by " +
+                    (w3mPreview ? "w3m" : "the built-in renderer") + ", " +
+                    std::to_string(previewStats.totalTime.count() / previewStats.count) + " us average, " +
+                    std::to_string(previewStats.maxTime.count()) + " us max");
+
+                const auto cacheStats = previewCache.getStats();
+                feedly.logMessage("Preview cache: "s + std::to_string(cacheStats.hits) + " hits, " +
+                    std::to_string(cacheStats.misses) + " misses, " +
+                    std::to_string(cacheStats.evictions) + " evictions, " +
+                    std::to_string(cacheStats.entries) + " entries in " +
+                    std::to_string(cacheStats.bytes / 1024) + " kB");
+        }
+#endif
+
         feedly.curl_cleanup();
 }
@@ -1,5 +1,11 @@
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
 
 #include <curses.h>
 #include <menu.h>
@@ -8,10 +14,67 @@
 #ifndef _CURSES_H
 #define _CURSES_H
 
+#include "ArticleView.h"
 #include "FeedlyProvider.h"
+#include "PostList.h"
+#include "PreviewCache.h"
 
 #define CTG_WIN_WIDTH 40
 #define VIEW_WIN_HEIGHT_PER 50
+#define LOAD_MORE_MARGIN 10
+#define DEFAULT_PREVIEW_CACHE_MEMORY_MB 8
+#define DEFAULT_PRERENDER_CONCURRENCY 2
+#define EVENT_LOOP_TICK std::chrono::milliseconds(250)
+#define EVENT_LOOP_IDLE_TICK std::chrono::milliseconds(1000)
+#define INPUT_LATENCY_TARGET std::chrono::milliseconds(50)
+#define ESCAPE_DELAY_MS 25
+#define CANCEL_KEY 27
+
+struct PreviewStats{
+        unsigned int count{};
+        unsigned int prerendered{};
+        std::chrono::microseconds totalTime{};
+        std::chrono::microseconds maxTime{};
+};
+
+// Time from reading a key to the screen being updated for it.
+struct InputLatencyStats{
+        unsigned long keys{};
+        unsigned long overTarget{};
+        std::chrono::microseconds totalTime{};
+        std::chrono::microseconds maxTime{};
+};
+
+// Terminal output of the event loop: frames flushed with doupdate, frames
+// skipped as nothing was drawn, and the bytes written under DEBUG, in all and
+// for painting keys.
+struct ScreenStats{
+        unsigned long flushes{};
+        unsigned long skipped{};
+        unsigned long long bytes{};
+        unsigned long long keyBytes{};
+        unsigned long keyFlushes{};
+        unsigned long maxKeyFlushes{};
+};
+
+// A network operation run off the UI thread. Once it is over, the event loop
+// calls done with its error message, empty on success. Exclusive tasks use
+// the main handle and replace the loaded posts, which are left alone until
+// they finish.
+struct BackgroundTask{
+        std::string status;
+        std::thread thread;
+        std::function<void(const std::string& errorMessage, bool cancelled)> done;
+        std::exception_ptr error;
+        bool exclusive{};
+        std::chrono::steady_clock::time_point started;
+};
+
+// The body stays packed until a pre-renderer picks the job up.
+struct PreviewJob{
+        std::string id;
+        PackedText content;
+};
 
 class CursesProvider{
         public:
@@ -24,26 +87,85 @@ class CursesProvider{
                 WINDOW *ctgWin, *postsWin, *viewWin, *ctgMenuWin, *postsMenuWin;
                 PANEL  *panels[3], *top;
                 std::vector<ITEM*> ctgItems{};
-                std::vector<ITEM*> postsItems{};
-                MENU *ctgMenu, *postsMenu;
+                MENU *ctgMenu;
+                PostList postsList;
+                ArticleView articleView;
+                bool postsActive{};
+                std::string postsCategory;
+                bool postsRank{};
+                bool groupBySource{};
                 std::string lastEntryRead, statusLine[3];
                 std::chrono::time_point<std::chrono::steady_clock> lastPostSelectionTime{std::chrono::time_point<std::chrono::steady_clock>::max()};
                 std::chrono::seconds secondsToMarkAsRead;
                 std::string textBrowser;
                 const std::filesystem::path previewPath;
+                bool w3mPreview{};
+                PreviewStats previewStats;
+                PreviewCache previewCache{DEFAULT_PREVIEW_CACHE_MEMORY_MB * 1024 * 1024};
+                unsigned int prerenderConcurrency{DEFAULT_PRERENDER_CONCURRENCY};
+                std::vector<std::thread> prerenderWorkers;
+                std::mutex prerenderMutex;
+                std::condition_variable prerenderCondition;
+                std::map<size_t, PreviewJob> prerenderJobs;
+                size_t prerenderCursor{};
+                size_t prerenderColumns{};
+                bool prerenderCacheFull{}, stopPrerender{};
+                BackgroundTask task;
+                bool taskRunning{}, taskCancelled{};
+                std::atomic<bool> taskFinished{};
+                int wakePipe[2]{-1, -1};
+                bool moveDownAfterLoad{}, loadingDeferred{};
+                std::chrono::steady_clock::time_point keyReceived{};
+                InputLatencyStats inputLatency;
+                ScreenStats screenStats;
+                std::string shownStatusLine;
+                std::vector<int> shownCounts;
                 bool currentRank{};
-                unsigned int totalPosts{};
-                unsigned int numUnread{};
                 int viewWinHeightPer = VIEW_WIN_HEIGHT_PER, viewWinHeight = 0, ctgWinWidth = CTG_WIN_WIDTH;
                 void clearCategoryItems();
-                void clearPostItems();
                 void createCategoriesMenu();
+                std::vector<ITEM*> categoryItems();
+                void updateCategories(std::function<void(bool updated)> then);
+                void replaceCategoryItems(std::map<std::string, std::string>&& labels);
+                void updateCategoryCounts();
                 void createPostsMenu();
                 void changeSelectedItem(MENU* curMenu, int req);
-                void ctgMenuCallback(const char* label);
-                void postsMenuCallback(ITEM* item, bool preview);
-                void markItemRead(ITEM* item);
-                void markItemReadAutomatically(ITEM* item);
+                void moveCursor(int direction);
+                void selectPost(size_t index, bool force = false);
+                void showPreview(size_t index);
+                int nextKey();
+                void renderFrame();
+                void waitForEvents();
+                void runTimers();
+                void startTask(const std::string& status, bool exclusive, std::function<void()> work, std::function<void(const std::string&, bool)> done);
+                void finishTask();
+                void cancelTask();
+                void abandonTask();
+                bool postsFrozen() const;
+                void ctgMenuCallback(const char* label, bool usePrefetched = false, std::function<void()> then = nullptr);
+                void showStoredPosts(const char* label);
+                void refreshPosts();
+                void sortPosts();
+                bool groupPosts();
+                void populatePostsMenu(const std::vector<PostHandle>* posts);
+                std::shared_ptr<const std::string> previewText(size_t index);
+                std::string renderPreview(const std::string& html, size_t columns);
+                void queuePreviews(std::map<size_t, PreviewJob>&& jobs, bool replace);
+                void queueLoadedPreviews();
+                void prioritisePreviews(size_t cursor);
+                void reindexPreviews(const std::vector<size_t>& previous);
+                void rewrapPreviews();
+                void prerenderWorker();
+                void stopPrerenderWorkers();
+                void prefetchNeighbours();
+                void loadMorePosts();
+                void appendPostItems(StreamPage&& page, const std::string& errorMessage, bool cancelled);
+                void loadPostWindow(size_t index);
+                void resumeLoading();
+                void postsMenuCallback(size_t index, bool preview);
+                void markItemRead(size_t index);
+                void markItemReadAutomatically(size_t index);
+                void showMarkerErrors();
                 void renderWindow(WINDOW *win, const char *label, int labelColor, bool highlight);
                 void printInMiddle(WINDOW *win, int starty, int startx, int width, const char *string, chtype color);
                 void printPostMenuMessage(const std::string& message);
@@ -0,0 +1,357 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <unordered_map>
+
+#include "EntryStore.h"
+
+namespace fs = std::filesystem;
+
+static const char STORE_MAGIC[8] = {'F', 'N', 'X', 'S', 'T', 'O', 'R', '3'};
+
+// All records only hold 8-byte fields, so their layout has no padding and
+// every table starts 8-byte aligned inside the mapping.
+struct StoreHeader{
+        char magic[8];
+        uint64_t entryCount;
+        uint64_t streamCount;
+        uint64_t streamEntryCount;
+        uint64_t blobSize;
+};
+
+struct StringRef{
+        uint64_t offset;
+        uint64_t length;
+};
+
+struct EntryRecord{
+        StringRef content, title, id, originURL, originTitle;
+        StringRef categories;
+        int64_t published;
+        int64_t crawled;
+        uint64_t contentLength;
+        uint64_t contentCompressed;
+        uint64_t unread;
+};
+
+struct StreamRecord{
+        StringRef id;
+        StringRef continuation;
+        int64_t syncPoint;
+        uint64_t firstEntry;
+        uint64_t entryCount;
+};
+
+static StringRef appendString(std::string& blob, std::string_view s){
+        const auto ref = StringRef{blob.size(), s.size()};
+        blob.append(s);
+        return ref;
+}
+
+EntryStore::EntryStore(const fs::path& path, PostStore& postStore):
+        storePath{path},
+        posts{postStore}{
+}
+void EntryStore::load(){
+        read.clear();
+        streams.clear();
+        dirty = false;
+
+        const auto fd = open(storePath.c_str(), O_RDONLY);
+        if(fd < 0){
+                return;
+        }
+
+        struct stat status{};
+        if(fstat(fd, &status) != 0 || static_cast<size_t>(status.st_size) < sizeof(StoreHeader)){
+                close(fd);
+                return;
+        }
+
+        const auto size = static_cast<uint64_t>(status.st_size);
+        const auto mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if(mapping == MAP_FAILED){
+                return;
+        }
+
+        const auto data = static_cast<const char*>(mapping);
+        const auto header = reinterpret_cast<const StoreHeader*>(data);
+
+        // A store that does not add up is only a cache miss, never an error.
+        const auto entriesOffset = sizeof(StoreHeader);
+        const auto streamsOffset = entriesOffset + header->entryCount * sizeof(EntryRecord);
+        const auto streamEntriesOffset = streamsOffset + header->streamCount * sizeof(StreamRecord);
+        const auto blobOffset = streamEntriesOffset + header->streamEntryCount * sizeof(uint64_t);
+        const auto valid = (memcmp(header->magic, STORE_MAGIC, sizeof(STORE_MAGIC)) == 0) &&
+            (header->entryCount < size) && (header->streamCount < size) && (header->streamEntryCount < size) &&
+            (blobOffset <= size) && (header->blobSize == size - blobOffset);
+
+        if(valid){
+                const auto records = reinterpret_cast<const EntryRecord*>(data + entriesOffset);
+                const auto streamRecords = reinterpret_cast<const StreamRecord*>(data + streamsOffset);
+                const auto streamEntries = reinterpret_cast<const uint64_t*>(data + streamEntriesOffset);
+                const auto blob = data + blobOffset;
+
+                auto corrupted = false;
+                const auto text = [&](const StringRef& ref){
+                        if(ref.offset > header->blobSize || ref.length > header->blobSize - ref.offset){
+                                corrupted = true;
+                                return std::string{};
+                        }
+                        return std::string(blob + ref.offset, ref.length);
+                };
+
+                // Checked before anything goes into the post store, which
+                // cannot take entries back.
+                for(uint64_t i = 0; (i < header->entryCount) && !corrupted; i++){
+                        const auto& record = records[i];
+                        for(const auto& ref : {record.content, record.title, record.id, record.originURL, record.originTitle, record.categories}){
+                                corrupted = corrupted || (ref.offset > header->blobSize) || (ref.length > header->blobSize - ref.offset);
+                        }
+                }
+                for(uint64_t i = 0; (i < header->streamCount) && !corrupted; i++){
+                        const auto& record = streamRecords[i];
+                        corrupted = (record.firstEntry > header->streamEntryCount) ||
+                            (record.entryCount > header->streamEntryCount - record.firstEntry);
+                        for(const auto& ref : {record.id, record.continuation}){
+                                corrupted = corrupted || (ref.offset > header->blobSize) || (ref.length > header->blobSize - ref.offset);
+                        }
+                }
+
+                auto handles = std::vector<PostHandle>{};
+                handles.reserve(corrupted ? 0 : header->entryCount);
+                for(uint64_t i = 0; (i < header->entryCount) && !corrupted; i++){
+                        const auto& record = records[i];
+                        auto post = PostData{};
+                        post.title = text(record.title);
+                        post.id = text(record.id);
+                        post.originURL = text(record.originURL);
+                        post.originTitle = text(record.originTitle);
+                        post.published = record.published;
+                        post.crawled = record.crawled;
+                        const auto categories = text(record.categories);
+                        for(size_t start = 0; start < categories.size();){
+                                auto end = categories.find('\n', start);
+                                if(end == std::string::npos){
+                                        end = categories.size();
+                                }
+                                post.categories.push_back(categories.substr(start, end - start));
+                                start = end + 1;
+                        }
+
+                        const auto content = PackedText{text(record.content), record.contentLength, record.contentCompressed != 0};
+                        handles.push_back(posts.add(post, content));
+                        if(record.unread == 0){
+                                setUnread(post.id, false);
+                        }
+                }
+
+                for(uint64_t i = 0; (i < header->streamCount) && !corrupted; i++){
+                        const auto& record = streamRecords[i];
+                        auto stream = StoredStream{};
+                        stream.continuation = text(record.continuation);
+                        stream.syncPoint = record.syncPoint;
+                        stream.posts.reserve(record.entryCount);
+                        for(uint64_t j = 0; j < record.entryCount; j++){
+                                const auto index = streamEntries[record.firstEntry + j];
+                                if(index < handles.size()){
+                                        stream.posts.push_back(handles[index]);
+                                }
+                        }
+                        streams.emplace(text(record.id), std::move(stream));
+                }
+        }
+
+        munmap(mapping, size);
+        dirty = false;
+}
+void EntryStore::save(){
+        if(!dirty){
+                return;
+        }
+
+        prune();
+
+        auto blob = std::string{};
+        auto records = std::vector<EntryRecord>{};
+        auto indices = std::unordered_map<PostHandle, uint64_t>{};
+        auto streamRecords = std::vector<StreamRecord>{};
+        auto streamEntries = std::vector<uint64_t>{};
+        for(const auto& [streamId, stream] : streams){
+                auto streamRecord = StreamRecord{};
+                streamRecord.id = appendString(blob, streamId);
+                streamRecord.continuation = appendString(blob, stream.continuation);
+                streamRecord.syncPoint = stream.syncPoint;
+                streamRecord.firstEntry = streamEntries.size();
+                streamRecord.entryCount = stream.posts.size();
+                streamRecords.push_back(streamRecord);
+
+                for(const auto handle : stream.posts){
+                        const auto [it, added] = indices.emplace(handle, records.size());
+                        streamEntries.push_back(it->second);
+                        if(!added){
+                                continue;
+                        }
+
+                        const auto post = posts.get(handle);
+                        const auto content = posts.packedContent(handle);
+                        auto record = EntryRecord{};
+                        record.content = appendString(blob, content.bytes);
+                        record.title = appendString(blob, post.title);
+                        record.id = appendString(blob, post.id);
+                        record.originURL = appendString(blob, post.originURL);
+                        record.originTitle = appendString(blob, post.originTitle);
+                        record.published = post.published;
+                        record.crawled = post.crawled;
+                        record.contentLength = content.length;
+                        record.contentCompressed = content.compressed ? 1 : 0;
+                        record.categories.offset = blob.size();
+                        const auto categories = posts.categories(handle);
+                        for(size_t i = 0; i < categories.size(); i++){
+                                if(i > 0){
+                                        blob.push_back('\n');
+                                }
+                                blob.append(categories[i]);
+                        }
+                        record.categories.length = blob.size() - record.categories.offset;
+                        record.unread = 1;
+                        records.push_back(record);
+                }
+        }
+
+        auto header = StoreHeader{};
+        memcpy(header.magic, STORE_MAGIC, sizeof(STORE_MAGIC));
+        header.entryCount = records.size();
+        header.streamCount = streamRecords.size();
+        header.streamEntryCount = streamEntries.size();
+        header.blobSize = blob.size();
+
+        auto temporaryPath = storePath;
+        temporaryPath += ".tmp";
+        {
+                auto file = std::ofstream(temporaryPath, std::ofstream::binary | std::ofstream::trunc);
+                file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+                file.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(EntryRecord));
+                file.write(reinterpret_cast<const char*>(streamRecords.data()), streamRecords.size() * sizeof(StreamRecord));
+                file.write(reinterpret_cast<const char*>(streamEntries.data()), streamEntries.size() * sizeof(uint64_t));
+                file.write(blob.data(), blob.size());
+                if(!file){
+                        return;
+                }
+        }
+
+        auto errorCode = std::error_code{};
+        fs::rename(temporaryPath, storePath, errorCode);
+        dirty = static_cast<bool>(errorCode);
+}
+// Read marks apply to any loaded post, so an entry read before its stream is
+// stored is not stored as unread.
+void EntryStore::setUnread(std::string_view id, bool unread){
+        const auto handle = posts.find(id);
+        if((handle == nullptr) || (isUnread(*handle) == unread)){
+                return;
+        }
+
+        if(*handle >= read.size()){
+                read.resize(posts.size(), false);
+        }
+        read[*handle] = !unread;
+        dirty = true;
+}
+// Marks the unread entries of the stored streams, the ones prune keeps.
+void EntryStore::keepListed(std::vector<bool>& keep) const{
+        for(const auto& [streamId, stream] : streams){
+                for(const auto handle : stream.posts){
+                        if(isUnread(handle)){
+                                keep.at(handle) = true;
+                        }
+                }
+        }
+}
+// Follows the posts to their handles after PostStore::compact, forgetting
+// those it dropped.
+void EntryStore::remap(const std::vector<PostHandle>& moved){
+        for(auto& [streamId, stream] : streams){
+                auto& handles = stream.posts;
+                for(auto& handle : handles){
+                        handle = moved.at(handle);
+                }
+                handles.erase(std::remove(handles.begin(), handles.end(), INVALID_POST_HANDLE), handles.end());
+        }
+
+        auto remapped = std::vector<bool>(posts.size(), false);
+        for(PostHandle handle = 0; handle < read.size(); handle++){
+                if(read[handle] && (moved.at(handle) != INVALID_POST_HANDLE)){
+                        remapped[moved[handle]] = true;
+                }
+        }
+        read = std::move(remapped);
+}
+const StoredStream* EntryStore::findStream(const std::string& streamId) const{
+        const auto it = streams.find(streamId);
+        return (it != streams.end()) ? &it->second : NULL;
+}
+void EntryStore::setStream(const std::string& streamId, StoredStream&& stream){
+        streams[streamId] = std::move(stream);
+        dirty = true;
+}
+// Forget every stream, so the next refresh of each one is a full fetch.
+void EntryStore::clearStreams(){
+        streams.clear();
+        dirty = true;
+}
+std::vector<PostHandle> EntryStore::unreadPosts(const std::string& streamId, size_t limit) const{
+        auto handles = std::vector<PostHandle>{};
+        if(const auto stream = findStream(streamId)){
+                for(const auto handle : stream->posts){
+                        if(handles.size() >= limit){
+                                break;
+                        }
+                        if(isUnread(handle)){
+                                handles.push_back(handle);
+                        }
+                }
+        }
+
+        return handles;
+}
+// Entries listed by the stored streams.
+size_t EntryStore::size() const{
+        auto listed = std::vector<bool>(posts.size(), false);
+        for(const auto& [streamId, stream] : streams){
+                for(const auto handle : stream.posts){
+                        listed[handle] = true;
+                }
+        }
+
+        return static_cast<size_t>(std::count(listed.begin(), listed.end(), true));
+}
+// Memory held by the store itself; the entries are counted by the post store.
+size_t EntryStore::bytes() const{
+        auto total = read.capacity() / 8;
+        for(const auto& [streamId, stream] : streams){
+                total += streamId.capacity() + stream.continuation.capacity() + stream.posts.capacity() * sizeof(PostHandle);
+        }
+
+        return total;
+}
+bool EntryStore::isUnread(PostHandle handle) const{
+        return (handle >= read.size()) || !read[handle];
+}
+// Only unread entries that belong to a stored stream are worth keeping, and
+// posts with only an id yet have nothing to keep.
+void EntryStore::prune(){
+        for(auto& [streamId, stream] : streams){
+                auto& handles = stream.posts;
+                handles.erase(std::remove_if(handles.begin(), handles.end(), [this](PostHandle handle){
+                        return !isUnread(handle) || posts.get(handle).partial;
+                }), handles.end());
+        }
+}
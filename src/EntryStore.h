@@ -0,0 +1,56 @@
+#include <filesystem>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifndef _ENTRY_STORE_H_
+#define _ENTRY_STORE_H_
+
+#include "PostData.h"
+#include "PostStore.h"
+
+// Entries of one stream in the order Feedly returned them, and where the
+// next synchronisation should continue from.
+struct StoredStream{
+        std::vector<PostHandle> posts;
+        std::string continuation;
+        long long syncPoint{};
+};
+
+// On-disk cache of the entries seen in previous sessions, so a stream can be
+// shown before the network answers and refreshed with newerThan.
+//
+// The file is a fixed-size header, a table of fixed-size entry and stream
+// records and a blob with all strings, bodies packed. It is memory-mapped on
+// load, and its entries go straight into the post store, bodies as they are.
+//
+// Entries are the posts the stored streams list, the newest-first ones; the
+// store only keeps their handles and which ones were read, so an entry is
+// held once, by the post store, and written out from it on save. Handles
+// must be remapped when the post store is compacted.
+class EntryStore{
+        public:
+                EntryStore(const std::filesystem::path& path, PostStore& postStore);
+                void load();
+                void save();
+                void setUnread(std::string_view id, bool unread);
+                void keepListed(std::vector<bool>& keep) const;
+                void remap(const std::vector<PostHandle>& moved);
+                const StoredStream* findStream(const std::string& streamId) const;
+                void setStream(const std::string& streamId, StoredStream&& stream);
+                void clearStreams();
+                std::vector<PostHandle> unreadPosts(const std::string& streamId, size_t limit) const;
+                size_t size() const;
+                size_t bytes() const;
+        private:
+                const std::filesystem::path storePath;
+                PostStore& posts;
+                std::vector<bool> read;
+                std::map<std::string, StoredStream> streams;
+                bool dirty{};
+                bool isUnread(PostHandle handle) const;
+                void prune();
+};
+
+#endif
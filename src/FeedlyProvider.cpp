@@ -8,33 +8,174 @@
 
 #include <iterator>
 #include <istream>
+#include <numeric>
+#include <utility>
 #include <termios.h>
 #include <unistd.h>
 #include <ctime>
+#include <sys/resource.h>
 
 #include "FeedlyProvider.h"
+#include "EntryStore.h"
+#include "StreamParser.h"
 
 namespace fs = std::filesystem;
 using namespace std::literals::string_literals;
-using FileStream = std::unique_ptr<FILE, decltype(&fclose)>;
+
+static size_t appendToBuffer(char* data, size_t size, size_t nmemb, void* userdata){
+        auto buffer = static_cast<std::string*>(userdata);
+        buffer->append(data, size * nmemb);
+        return size * nmemb;
+}
+
+// Keeps the validators of a response as its headers arrive. Headers of
+// redirects and interim responses are seen too, so start over on each status
+// line.
+static size_t collectValidators(char* data, size_t size, size_t nmemb, void* userdata){
+        auto response = static_cast<CachedResponse*>(userdata);
+        const auto line = std::string(data, size * nmemb);
+        const auto colon = line.find(':');
+
+        if(line.compare(0, 5, "HTTP/") == 0){
+                response->etag.clear();
+                response->lastModified.clear();
+        }
+        else if(colon != std::string::npos){
+                auto name = line.substr(0, colon);
+                std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+                const auto begin = line.find_first_not_of(" \t", colon + 1);
+                const auto end = line.find_last_not_of(" \t\r\n");
+                const auto value = (begin != std::string::npos && end >= begin) ? line.substr(begin, end - begin + 1) : std::string{};
+                if(name == "etag"){
+                        response->etag = value;
+                }
+                else if(name == "last-modified"){
+                        response->lastModified = value;
+                }
+        }
+
+        return size * nmemb;
+}
+
+struct StreamContext{
+        StreamParser* parser;
+        std::string* dump;
+        std::exception_ptr error;
+        std::chrono::steady_clock::duration parseTime;
+        size_t bytes;
+};
+
+// Hands every chunk to the stream parser as soon as curl receives it.
+// Exceptions must not cross libcurl, so they are kept until the transfer aborts.
+static size_t feedStreamParser(char* data, size_t size, size_t nmemb, void* userdata){
+        auto context = static_cast<StreamContext*>(userdata);
+        try{
+                if(context->dump != NULL){
+                        context->dump->append(data, size * nmemb);
+                }
+                context->bytes += size * nmemb;
+
+                const auto start = std::chrono::steady_clock::now();
+                context->parser->feed(data, size * nmemb);
+                context->parseTime += std::chrono::steady_clock::now() - start;
+        }
+        catch(...){
+                context->error = std::current_exception();
+                return 0;
+        }
+
+        return size * nmemb;
+}
+
+static void lockShare(CURL*, curl_lock_data data, curl_lock_access, void* userptr){
+        static_cast<std::mutex*>(userptr)[data].lock();
+}
+static void unlockShare(CURL*, curl_lock_data data, void* userptr){
+        static_cast<std::mutex*>(userptr)[data].unlock();
+}
+
+static size_t postSize(const PostData& post){
+        return sizeof(PostData) + post.content.capacity() + post.title.capacity() + post.id.capacity() +
+            post.originURL.capacity() + post.originTitle.capacity();
+}
+
+using CurlMulti = std::unique_ptr<CURLM, decltype(&curl_multi_cleanup)>;
+
+// One stream of refreshAllStreams, parsed while its transfer is running.
+struct RefreshTransfer{
+        RefreshTransfer(const std::string& label, const std::string& streamId, const std::string& rank):
+                label{label},
+                streamId{streamId},
+                stream{rank, {}, {}, 0, std::chrono::steady_clock::now()},
+                parser{[this](PostData&& post){
+                        stream.bytes += postSize(post);
+                        stream.posts.push_back(std::move(post));
+                }},
+                context{&parser, NULL, nullptr, {}, 0}{
+        }
+
+        const std::string label;
+        const std::string streamId;
+        PrefetchedStream stream;
+        StreamParser parser;
+        StreamContext context;
+};
 
 FeedlyProvider::FeedlyProvider(const fs::path& tmpDir):
-        tempPath{tmpDir / "temp.txt"}{
+        tempDir{tmpDir},
+        entryStore{fs::path{getenv("HOME")} / ".config" / "feednix" / "entries.db", postStore},
+        httpCache{fs::path{getenv("HOME")} / ".config" / "feednix" / "http-cache.json"}{
 
         curl_global_init(CURL_GLOBAL_DEFAULT);
 
+        // Every easy handle is attached to one share handle, so TLS sessions and
+        // resolved addresses survive between requests and threads. Connections are
+        // not shared: libcurl does not support one cache for handles used at once
+        // from several threads, and each thread keeps its handle, and so its
+        // keep-alive connections, for as long as it runs.
+        curlShare = curl_share_init();
+        curl_share_setopt(curlShare, CURLSHOPT_LOCKFUNC, lockShare);
+        curl_share_setopt(curlShare, CURLSHOPT_UNLOCKFUNC, unlockShare);
+        curl_share_setopt(curlShare, CURLSHOPT_USERDATA, shareLocks.data());
+        curl_share_setopt(curlShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(curlShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
+        curl = newCurlHandle();
+        taskCurl = newCurlHandle();
+
         const auto configRoot = fs::path{getenv("HOME")} / ".config" / "feednix";
         configPath = configRoot / "config.json";
         logPath = configRoot / "log.txt";
+        journalPath = configRoot / "journal.txt";
 
         Json::Value root;
         Json::Reader reader;
 
         std::ifstream tokenFile(configPath.c_str(), std::ifstream::binary);
         if(reader.parse(tokenFile, root)){
-                rtrv_count = root["posts_retrive_count"].asString();
+                // posts_retrive_count is documented as a string, but accept a number as well.
+                const auto count = atoi(root["posts_retrive_count"].asString().c_str());
+                if(count > 0){
+                        rtrv_count = std::min(count, MAX_FCOUNT);
+                }
+                dumpResponses = root["debug_dump_responses"].asBool();
+                idsFirst = root["load_ids_first"].asBool();
+
+                if(root.isMember("prefetch_concurrency")){
+                        prefetchConcurrency = std::max(0, root["prefetch_concurrency"].asInt());
+                }
+                if(root.isMember("refresh_concurrency")){
+                        refreshConcurrency = std::max(1, root["refresh_concurrency"].asInt());
+                }
+                if(root.isMember("prefetch_memory_limit_mb")){
+                        prefetchMemoryLimit = static_cast<size_t>(std::max(0, root["prefetch_memory_limit_mb"].asInt())) * 1024 * 1024;
+                }
         }
         tokenFile.close();
+
+        entryStore.load();
+        httpCache.load();
 }
 void FeedlyProvider::authenticateUser(){
         Json::Value root;
@@ -44,9 +185,7 @@ void FeedlyProvider::authenticateUser(){
         bool parsingSuccesful = reader.parse(initialConfig, root);
 
         if(!parsingSuccesful){
-                openLogStream();
-                log_stream << "ERROR: Log In Failed - Unable to read from config file" << std::endl;
-                log_stream << reader.getFormattedErrorMessages() << std::endl;
+                logMessage("ERROR: Log In Failed - Unable to read from config file\n" + reader.getFormattedErrorMessages());
                 exit(EXIT_FAILURE);
         }
 
@@ -91,181 +230,1214 @@ void FeedlyProvider::authenticateUser(){
                 newConfig << root;
 
                 newConfig.close();
+
+                // Whatever was cached belongs to the previous account.
+                httpCache.clear();
         }
         initialConfig.close();
 
         user_data.authToken = (root["developer_token"]).asString();
         user_data.id = (root["userID"]).asString();
+
+        buildAuthHeaders();
+        replayJournal();
+}
+void FeedlyProvider::buildAuthHeaders(){
+        curl_slist_free_all(getHeaders);
+        curl_slist_free_all(postHeaders);
+
+        const auto authorization = "Authorization: OAuth " + user_data.authToken;
+        getHeaders = curl_slist_append(NULL, authorization.c_str());
+        postHeaders = curl_slist_append(NULL, authorization.c_str());
+        postHeaders = curl_slist_append(postHeaders, "Content-Type: application/json");
 }
+// The categories as the last session left them in the HTTP cache, so the
+// menu can be drawn before any request; setLabels brings them up to date.
 const std::map<std::string, std::string>& FeedlyProvider::getLabels(){
-        user_data.categories.clear();
-        user_data.categories["All"] = "user/" + user_data.id + "/category/global.all";
-        user_data.categories["Saved"] = "user/" + user_data.id + "/tag/global.saved";
-        user_data.categories["Uncategorized"] = "user/" + user_data.id + "/category/global.uncategorized";
+        if(user_data.categories.empty()){
+                auto root = Json::Value{};
+                if(const auto cached = httpCache.find("categories")){
+                        try{
+                                root = parseResponse(cached->body);
+                        }
+                        catch(const std::exception&){
+                        }
+                }
+                user_data.categories = makeLabels(root);
+        }
+
+        return user_data.categories;
+}
+// Fetches the categories on the handle of background tasks, leaving those in
+// use alone.
+std::map<std::string, std::string> FeedlyProvider::fetchLabels(){
+        try{
+                auto body = std::string{};
+                return makeLabels(curl_revalidate(taskCurl, body, "categories"));
+        }
+        catch(const std::exception& e){
+                logMessage("Could not get labels\n"s + e.what());
+                throw;
+        }
+}
+void FeedlyProvider::setLabels(std::map<std::string, std::string>&& labels){
+        user_data.categories = std::move(labels);
+}
+std::map<std::string, std::string> FeedlyProvider::makeLabels(const Json::Value& root) const{
+        auto labels = std::map<std::string, std::string>{};
+        labels["All"] = "user/" + user_data.id + "/category/global.all";
+        labels["Saved"] = "user/" + user_data.id + "/tag/global.saved";
+        labels["Uncategorized"] = "user/" + user_data.id + "/category/global.uncategorized";
+
+        for(const auto& item : root){
+                labels[item["label"].asString()] = item["id"].asString();
+        }
+
+        return labels;
+}
+// One request for the unread count of every category, so that categories
+// with nothing unread do not have to be opened to find out. Runs on the
+// handle of background tasks.
+void FeedlyProvider::fetchUnreadCounts(){
+        auto body = std::string{};
+        fetchUnreadCounts(taskCurl, body);
+}
+void FeedlyProvider::fetchUnreadCounts(CURL* handle, std::string& body){
+        auto counts = std::map<std::string, int>{};
 
         try{
-                const auto root{ curl_retrieve("categories") };
-                for(const auto& item : root){
-                    user_data.categories[item["label"].asString()] = item["id"].asString();
+                const auto root{ curl_request(handle, body, "markers/counts", Json::Value::nullSingleton()) };
+                for(const auto& item : root["unreadcounts"]){
+                        counts[item["id"].asString()] = item["count"].asInt();
                 }
         }
         catch(const std::exception& e){
-                openLogStream();
-                log_stream << "Could not get labels" << std::endl;
-                log_stream << e.what() << std::endl;
+                logMessage("Could not get unread counts\n"s + e.what());
+                auto lock = std::lock_guard(countsMutex);
+                unreadCounts.clear();
                 throw;
         }
 
-        return user_data.categories;
+        auto lock = std::lock_guard(countsMutex);
+        unreadCounts.swap(counts);
 }
-CurlString FeedlyProvider::escapeCurlString(const std::string& s){
-        return CurlString(curl_easy_escape(curl, s.c_str(), 0), &curl_free);
+// Returns -1 if the count of the category is not known. Unlike the rest of
+// the provider, the counts may be read while a stream loads in the background.
+int FeedlyProvider::getUnreadCount(const std::string& label){
+        const auto category = user_data.categories.find(label);
+        if(category == user_data.categories.end()){
+                return -1;
+        }
+
+        auto lock = std::lock_guard(countsMutex);
+        const auto it = unreadCounts.find(category->second);
+        return (it != unreadCounts.end()) ? it->second : -1;
 }
-const std::vector<PostData>& FeedlyProvider::giveStreamPosts(const std::string& category, bool whichRank){
-        feeds.clear();
+// Applies a read-state change of a loaded entry to the counts of "All" and
+// of the categories it belongs to.
+void FeedlyProvider::adjustUnreadCounts(const std::string& entryId, int delta){
+        const auto handle = postStore.find(entryId);
+        if(handle == nullptr){
+                return;
+        }
 
-        std::string rank = "newest";
-        if(whichRank){
-                rank = "oldest";
+        auto streams = std::vector<std::string>{};
+        for(const auto category : postStore.categories(*handle)){
+                streams.emplace_back(category);
+        }
+        if(streams.empty()){
+                streams.push_back(user_data.categories["Uncategorized"]);
         }
+        streams.push_back(user_data.categories["All"]);
 
-        Json::Value root;
-        try{
-                if(category == "All"){
-                        const auto streamId = escapeCurlString(user_data.categories["All"]);
-                        root = curl_retrieve("streams/contents?ranked="s + rank + "&count=" + rtrv_count + "&unreadOnly=true&streamId=" + streamId.get());
+        auto lock = std::lock_guard(countsMutex);
+        for(const auto& id : streams){
+                if(const auto it = unreadCounts.find(id); it != unreadCounts.end()){
+                        it->second = std::max(0, it->second + delta);
                 }
-                else if(category == "Uncategorized"){
-                        const auto streamId = escapeCurlString(user_data.categories["Uncategorized"]);
-                        root = curl_retrieve("streams/contents?ranked="s + rank + "&count="s + rtrv_count + "&unreadOnly=true&streamId=" + streamId.get());
+        }
+}
+CurlString FeedlyProvider::escapeCurlString(CURL* handle, const std::string& s){
+        return CurlString(curl_easy_escape(handle, s.c_str(), 0), &curl_free);
+}
+// The posts of a stream are handles into the post store, which keeps every
+// entry loaded for any stream. Once it holds some, a stream is listed by id
+// and only the bodies of entries no other stream loaded are fetched, so
+// coming back to a stream, or opening a category after "All", downloads
+// hardly more than the ids.
+const std::vector<PostHandle>& FeedlyProvider::giveStreamPosts(const std::string& category, bool whichRank, bool usePrefetched){
+        feeds.clear();
+        compactPostStore();
+        feeds.reserve(rtrv_count);
+
+        streamId = user_data.categories[category];
+        streamRank = whichRank ? "oldest" : "newest";
+        streamContinuation.clear();
+        shareEntries = !idsFirst && (postStore.size() > 0);
+
+        if(idsFirst){
+                fetchStreamPage(std::min<unsigned int>(IDS_PAGE_FCOUNT, rtrv_count));
+                if(const auto ids = partialPostsAround(0); !ids.empty()){
+                        completePosts(ids, fetchPosts(curl, ids));
                 }
-                else if(category == "Saved"){
-                        const auto streamId = escapeCurlString(user_data.categories["Saved"]);
-                        root = curl_retrieve("streams/contents?ranked="s + rank + "&count="s + rtrv_count + "&unreadOnly=true&streamId=" + streamId.get());
+                return feeds;
+        }
+
+        if(usePrefetched && takePrefetchedStream(category)){
+                storeStream();
+                return feeds;
+        }
+
+        if(syncStoredStream()){
+                return feeds;
+        }
+
+        // A small first page keeps the time to the first post independent of the
+        // number of unread entries, the rest is paged in by fetchMorePosts.
+        fetchStreamPage(std::min<unsigned int>(FIRST_PAGE_FCOUNT, rtrv_count));
+
+        return feeds;
+}
+// Posts of a stream as they were stored at the end of the last session,
+// available before any request is made.
+const std::vector<PostHandle>& FeedlyProvider::giveStoredPosts(const std::string& category, bool whichRank){
+        feeds.clear();
+        feeds.reserve(rtrv_count);
+
+        streamId = user_data.categories[category];
+        streamRank = whichRank ? "oldest" : "newest";
+        streamContinuation.clear();
+
+        if(!whichRank){
+                for(const auto handle : entryStore.unreadPosts(streamId, rtrv_count)){
+                        feeds.push_back(handle);
                 }
-                else{
-                        const auto streamId = escapeCurlString(user_data.categories[category]);
-                        root = curl_retrieve("streams/"s + streamId.get() + "/contents?unreadOnly=true&ranked=newest&count="s + rtrv_count);
+                if(const auto stored = entryStore.findStream(streamId)){
+                        streamContinuation = stored->continuation;
                 }
         }
+
+        return feeds;
+}
+// Refreshes a stream that was stored before by asking only for the entries
+// crawled since the last sync and putting them in front of the stored ones.
+// Only the newest-first order can be extended that way.
+bool FeedlyProvider::syncStoredStream(){
+        const auto stored = entryStore.findStream(streamId);
+        if((streamRank != "newest") || (stored == NULL) || (stored->syncPoint == 0)){
+                return false;
+        }
+
+        auto continuation = std::string{};
+        try{
+                do{
+                        const auto count = std::min<unsigned int>(PAGE_FCOUNT, rtrv_count - feeds.size());
+                        if(shareEntries){
+                                auto ids = std::vector<std::string>{};
+                                continuation = fetchStreamIds(curl, count, continuation, ids, stored->syncPoint);
+                                auto added = fetchMissingEntries(curl, ids);
+                                for(const auto& id : ids){
+                                        auto handle = PostHandle{};
+                                        if((feeds.size() < rtrv_count) && findListedPost(id, added, handle)){
+                                                feeds.push_back(handle);
+                                        }
+                                }
+                        }
+                        else{
+                                continuation = fetchStream(curl, streamId, streamRank, count, continuation, [this](PostData&& post){
+                                        if(feeds.size() < rtrv_count){
+                                                feeds.push_back(addPost(post));
+                                        }
+                                }, stored->syncPoint);
+                        }
+                } while(!continuation.empty() && (feeds.size() < rtrv_count));
+        }
         catch(const std::exception& e){
-                openLogStream();
-                log_stream << "Could not get posts" << std::endl;
-                log_stream << e.what() << std::endl;
+                logMessage("Could not get posts\n"s + e.what());
                 throw;
         }
 
-        for(const auto& item : root["items"]){
-                auto url = std::string{};
-                for(const auto& alternate : item["alternate"]){
-                        if(alternate["type"].asString() == "text/html"){
-                                url = alternate["href"].asString();
-                                break;
+        const auto newPosts = feeds.size();
+        if(newPosts >= rtrv_count){
+                // Everything stored was pushed out of the window.
+                streamContinuation = continuation;
+        }
+        else{
+                auto listed = std::vector<bool>(postStore.size(), false);
+                for(const auto handle : feeds){
+                        listed[handle] = true;
+                }
+                for(const auto handle : entryStore.unreadPosts(streamId, rtrv_count)){
+                        if((feeds.size() < rtrv_count) && !listed[handle]){
+                                feeds.push_back(handle);
                         }
                 }
+                streamContinuation = stored->continuation;
+        }
+
+        storeStream();
 
-                feeds.push_back({
-                    item["summary"]["content"].asString(),
-                    item["title"].asString(),
-                    item["id"].asString(),
-                    url,
-                    item["origin"]["title"].asString()});
+        return true;
+}
+// Adds a post to the loaded ones. An entry loaded already, for this stream or
+// another, is not packed again.
+PostHandle FeedlyProvider::addPost(const PostData& post){
+        const auto known = postStore.find(post.id);
+        if((known != nullptr) && (post.partial || !postStore.get(*known).partial)){
+                return *known;
         }
 
-        return feeds;
+        return postStore.add(post);
 }
-void FeedlyProvider::markPostsRead(const std::vector<std::string>& ids){
-        Json::Value jsonCont;
-        Json::Value array;
+// Finds the post of an id listed by streams/ids: one loaded for any stream,
+// or one of added. When loading ids first, an entry not loaded yet becomes a
+// partial post. Returns false for an entry deleted since it was listed.
+bool FeedlyProvider::findListedPost(const std::string& id, std::map<std::string, PostData>& added, PostHandle& handle){
+        if(const auto known = postStore.find(id)){
+                handle = *known;
+                return true;
+        }
 
-        jsonCont["type"] = "entries";
+        if(const auto it = added.find(id); it != added.end()){
+                handle = addPost(it->second);
+                return true;
+        }
 
-        for(const auto& id : ids){
-                array.append("entryIds") = id;
+        if(idsFirst){
+                auto post = PostData{};
+                post.id = id;
+                post.partial = true;
+                handle = addPost(post);
+                return true;
         }
 
-        jsonCont["entryIds"] = array;
-        jsonCont["action"] = "markAsRead";
+        return false;
+}
+// Records the order of the loaded stream in the entry store.
+void FeedlyProvider::storeStream(){
+        auto stream = StoredStream{};
+        stream.continuation = streamContinuation;
+        if(const auto stored = entryStore.findStream(streamId)){
+                stream.syncPoint = stored->syncPoint;
+        }
+
+        stream.posts = feeds;
+        for(const auto handle : feeds){
+                stream.syncPoint = std::max(stream.syncPoint, postStore.get(handle).crawled);
+        }
+
+        // Only the newest-first view is a prefix that later syncs can extend,
+        // so only its entries are stored.
+        if(streamRank == "newest"){
+                entryStore.setStream(streamId, std::move(stream));
+        }
+
+        updateStreamUnreadCount();
+}
+// Posts no longer listed are only worth keeping when the entry store will
+// show them again. Once the others, along with the text of completed posts,
+// make up half of the post store, it is rebuilt without them.
+void FeedlyProvider::compactPostStore(){
+        auto keep = std::vector<bool>(postStore.size(), false);
+        for(const auto handle : feeds){
+                keep[handle] = true;
+        }
+        entryStore.keepListed(keep);
 
+        const auto kept = static_cast<size_t>(std::count(keep.begin(), keep.end(), true));
+        if((kept * 2 >= postStore.size()) && (postStore.replacedBytes() * 2 < postStore.textBytes())){
+                return;
+        }
+
+        const auto moved = postStore.compact(keep);
+        for(auto& handle : feeds){
+                handle = moved[handle];
+        }
+        entryStore.remap(moved);
+}
+// A stream loaded to its end tells exactly how many entries are unread.
+void FeedlyProvider::updateStreamUnreadCount(){
+        if(streamContinuation.empty()){
+                auto lock = std::lock_guard(countsMutex);
+                if(const auto it = unreadCounts.find(streamId); it != unreadCounts.end()){
+                        it->second = feeds.size();
+                }
+        }
+}
+bool FeedlyProvider::hasMorePosts() const{
+        return !streamContinuation.empty() && (feeds.size() < rtrv_count);
+}
+// Fetches the page after the loaded posts on the handle of background tasks.
+// Only the position in the stream and which entries are loaded are read, and
+// the post store only changes on the UI thread once the page is in, so the
+// loaded posts can be used while it runs on another thread; the page is added
+// by appendPosts.
+StreamPage FeedlyProvider::fetchMorePosts(){
+        if(!hasMorePosts()){
+                auto page = StreamPage{};
+                page.continuation = streamContinuation;
+                return page;
+        }
+
+        const auto pageCount = idsFirst ? IDS_PAGE_FCOUNT : PAGE_FCOUNT;
+        return fetchPage(taskCurl, std::min<unsigned int>(pageCount, rtrv_count - feeds.size()));
+}
+// Adds a page fetched by fetchMorePosts and returns how many posts it added.
+// A page without continuation ends the stream.
+size_t FeedlyProvider::appendPosts(StreamPage&& page){
+        const auto previousSize = feeds.size();
+        for(const auto& post : page.posts){
+                if(feeds.size() < rtrv_count){
+                        feeds.push_back(addPost(post));
+                }
+        }
+        for(const auto& id : page.ids){
+                auto handle = PostHandle{};
+                if((feeds.size() < rtrv_count) && findListedPost(id, page.added, handle)){
+                        feeds.push_back(handle);
+                }
+        }
+        streamContinuation = std::move(page.continuation);
+
+        // Posts that only have an id yet are stored once they are loaded.
+        if(idsFirst){
+                updateStreamUnreadCount();
+        }
+        else{
+                storeStream();
+        }
+
+        return feeds.size() - previousSize;
+}
+void FeedlyProvider::fetchStreamPage(unsigned int count){
         try{
-                curl_retrieve("markers", jsonCont);
+                appendPosts(fetchPage(curl, count));
         }
-        catch(const std::exception& e){
-                openLogStream();
-                log_stream << "Could not mark post(s) as read" << std::endl;
-                log_stream << e.what() << std::endl;
+        catch(const std::exception&){
+                streamContinuation.clear();
                 throw;
         }
 }
-void FeedlyProvider::markPostsUnread(const std::vector<std::string>& ids){
-        Json::Value jsonCont;
-        Json::Value array;
+// Fetches the next page of the stream, either whole entries or its ids. When
+// sharing entries, the bodies the post store lacks come with the ids; when
+// loading ids first, they are fetched by fetchPosts once the cursor comes
+// near them.
+StreamPage FeedlyProvider::fetchPage(CURL* handle, unsigned int count){
+        auto page = StreamPage{};
+        try{
+                if(idsFirst || shareEntries){
+                        page.continuation = fetchStreamIds(handle, count, streamContinuation, page.ids);
+                        if(shareEntries){
+                                page.added = fetchMissingEntries(handle, page.ids);
+                        }
+                }
+                else{
+                        page.continuation = fetchStream(handle, streamId, streamRank, count, streamContinuation, [&page](PostData&& post){
+                                page.posts.push_back(std::move(post));
+                        });
+                }
+        }
+        catch(const std::exception& e){
+                logMessage("Could not get posts\n"s + e.what());
+                throw;
+        }
 
-        jsonCont["type"] = "entries";
+        return page;
+}
+// Appends the ids of one page of unread entries of the stream, optionally
+// only those crawled after newerThan, and returns its continuation token.
+std::string FeedlyProvider::fetchStreamIds(CURL* handle, unsigned int count, const std::string& continuation, std::vector<std::string>& ids, long long newerThan){
+        const auto escapedId = escapeCurlString(handle, streamId);
+        auto uri = "streams/ids?ranked="s + streamRank + "&count=" + std::to_string(count) + "&unreadOnly=true&streamId=" + escapedId.get();
+        if(newerThan > 0){
+                uri += "&newerThan=" + std::to_string(newerThan);
+        }
+        if(!continuation.empty()){
+                const auto escapedContinuation = escapeCurlString(handle, continuation);
+                uri += "&continuation="s + escapedContinuation.get();
+        }
 
-        for(const auto& id : ids){
-                array.append("entryIds") = id;
+        auto body = std::string{};
+        const auto root{ curl_request(handle, body, uri, Json::Value::nullSingleton()) };
+        for(const auto& id : root["ids"]){
+                ids.push_back(id.asString());
         }
 
-        jsonCont["entryIds"] = array;
-        jsonCont["action"] = "keepUnread";
+        return root["continuation"].asString();
+}
+// Fetches whole entries by id in one entries/.mget request. Entries deleted
+// since their id was listed are missing from the result.
+std::map<std::string, PostData> FeedlyProvider::fetchEntries(CURL* handle, std::string& body, const Json::Value& ids){
+        auto entries = std::map<std::string, PostData>{};
+        curl_request(handle, body, "entries/.mget", ids);
+
+        // The response is a bare array of entries; wrapped like a stream it
+        // goes through the same parser.
+        static const char prefix[] = "{\"items\":";
+        auto parser = StreamParser([&entries](PostData&& post){
+                auto id = post.id;
+                entries[id] = std::move(post);
+        });
+        parser.feed(prefix, sizeof(prefix) - 1);
+        parser.feed(body.data(), body.size());
+        parser.feed("}", 1);
+        parser.finish();
+
+        return entries;
+}
+// Fetches the bodies of the listed entries the post store does not hold, in
+// batches of IDS_PAGE_FCOUNT.
+std::map<std::string, PostData> FeedlyProvider::fetchMissingEntries(CURL* handle, const std::vector<std::string>& ids){
+        auto entries = std::map<std::string, PostData>{};
+        auto body = std::string{};
+        Json::Value missing(Json::arrayValue);
+        for(size_t i = 0; i < ids.size(); i++){
+                if(postStore.find(ids[i]) == nullptr){
+                        missing.append(ids[i]);
+                }
+                if((missing.size() == IDS_PAGE_FCOUNT) || ((i + 1 == ids.size()) && !missing.empty())){
+                        entries.merge(fetchEntries(handle, body, missing));
+                        missing.clear();
+                }
+        }
 
+        return entries;
+}
+// Fetches the ids of the loaded part of the stream as it is now, and the
+// bodies of the posts among them that are not loaded for any stream; posts
+// read elsewhere are simply missing. Like fetchMorePosts it only reads the
+// loaded posts, the changes are applied by applyStreamChanges.
+StreamChanges FeedlyProvider::fetchStreamChanges(){
+        const auto count = std::min<size_t>(std::max<size_t>(feeds.size(), FIRST_PAGE_FCOUNT), rtrv_count);
+        auto changes = StreamChanges{};
         try{
-                curl_retrieve("markers", jsonCont);
+                do{
+                        const auto pageCount = std::min<size_t>(IDS_PAGE_FCOUNT, count - changes.ids.size());
+                        changes.continuation = fetchStreamIds(curl, pageCount, changes.continuation, changes.ids);
+                } while(!changes.continuation.empty() && (changes.ids.size() < count));
+
+                // When loading ids first, the bodies of new posts are fetched
+                // once the cursor comes near.
+                if(!idsFirst){
+                        changes.added = fetchMissingEntries(curl, changes.ids);
+                }
         }
         catch(const std::exception& e){
-                openLogStream();
-                log_stream << "Could not mark post(s) as unread" << std::endl;
-                log_stream << e.what() << std::endl;
+                logMessage("Could not refresh posts\n"s + e.what());
                 throw;
         }
+
+        return changes;
 }
-void FeedlyProvider::markPostsSaved(const std::vector<std::string>& ids){
-        Json::Value jsonCont;
-        Json::Value array;
+// Makes the loaded posts those fetched by fetchStreamChanges, keeping the
+// ones that were loaded already. Returns, for each post, its index before the
+// change or NEW_POST_INDEX for the new ones.
+std::vector<size_t> FeedlyProvider::applyStreamChanges(StreamChanges&& changes){
+        auto positions = std::vector<size_t>(postStore.size(), NEW_POST_INDEX);
+        for(size_t i = 0; i < feeds.size(); i++){
+                positions[feeds[i]] = i;
+        }
 
-        jsonCont["type"] = "entries";
+        auto handles = std::vector<PostHandle>{};
+        handles.reserve(std::max<size_t>(changes.ids.size(), rtrv_count));
+        auto previous = std::vector<size_t>{};
+        previous.reserve(changes.ids.size());
+        for(const auto& id : changes.ids){
+                auto handle = PostHandle{};
+                if(!findListedPost(id, changes.added, handle)){
+                        continue;
+                }
 
-        for(const auto& id : ids){
-                array.append("entryIds") = id;
+                // Posts loaded for another stream are new to this one.
+                handles.push_back(handle);
+                if(handle < positions.size()){
+                        previous.push_back(std::exchange(positions[handle], NEW_POST_INDEX));
+                }
+                else{
+                        previous.push_back(NEW_POST_INDEX);
+                }
         }
 
-        jsonCont["entryIds"] = array;
-        jsonCont["action"] = "markAsSaved";
+        feeds = std::move(handles);
+        streamContinuation = std::move(changes.continuation);
+
+        // The new posts were stored as they were added; the stream is
+        // recorded anew.
+        if(idsFirst){
+                updateStreamUnreadCount();
+        }
+        else{
+                storeStream();
+        }
+
+        return previous;
+}
+// Whether the loaded posts are the whole unread stream with their times
+// known, so that they can be put in another order without asking for them
+// again.
+bool FeedlyProvider::canSortLocally() const{
+        return streamContinuation.empty() && std::none_of(feeds.begin(), feeds.end(), [this](PostHandle handle){
+                return postStore.get(handle).partial;
+        });
+}
+// Puts the loaded posts in crawl time order, oldest or newest first, and with
+// bySource grouped by origin first; posts that only have an id yet keep their
+// order at the end. Sorted whole, the stream takes the rank of the order, so
+// refreshing it keeps it; a part of it keeps its rank, which its next pages
+// come in. Returns, for each post, its index before.
+std::vector<size_t> FeedlyProvider::sortPosts(bool oldestFirst, bool bySource){
+        const auto whole = canSortLocally();
+        auto posts = std::vector<PostView>{};
+        posts.reserve(feeds.size());
+        for(const auto handle : feeds){
+                posts.push_back(postStore.get(handle));
+        }
+
+        auto previous = std::vector<size_t>(feeds.size());
+        std::iota(previous.begin(), previous.end(), 0);
+        std::stable_sort(previous.begin(), previous.end(), [&posts, oldestFirst, bySource](size_t a, size_t b){
+                const auto& first = posts[a];
+                const auto& second = posts[b];
+                if(first.partial || second.partial){
+                        return !first.partial && second.partial;
+                }
+                if(bySource && (first.originTitle != second.originTitle)){
+                        return first.originTitle < second.originTitle;
+                }
+
+                const auto firstTime = std::make_pair(first.crawled, first.published);
+                const auto secondTime = std::make_pair(second.crawled, second.published);
+                return oldestFirst ? (firstTime < secondTime) : (secondTime < firstTime);
+        });
+
+        auto handles = std::vector<PostHandle>{};
+        handles.reserve(std::max<size_t>(feeds.size(), rtrv_count));
+        for(const auto i : previous){
+                handles.push_back(feeds[i]);
+        }
+        feeds = std::move(handles);
+        if(whole){
+                streamRank = oldestFirst ? "oldest" : "newest";
+        }
+
+        return previous;
+}
+// Once the cursor at index comes within ENTRY_LOAD_MARGIN of a partial post,
+// returns the ids of the next ENTRY_BATCH_COUNT partial posts around it, to
+// be fetched by fetchPosts in one entries/.mget request.
+std::vector<std::string> FeedlyProvider::partialPostsAround(size_t index) const{
+        auto ids = std::vector<std::string>{};
+        if(!idsFirst || index >= feeds.size()){
+                return ids;
+        }
+
+        const auto isPartial = [this](PostHandle handle){
+                return postStore.get(handle).partial;
+        };
+        const auto end = feeds.begin() + std::min(feeds.size(), index + ENTRY_LOAD_MARGIN + 1);
+        if(std::none_of(feeds.begin() + index, end, isPartial)){
+                return ids;
+        }
+
+        for(auto i = (index > ENTRY_LOAD_MARGIN) ? index - ENTRY_LOAD_MARGIN : 0; (i < feeds.size()) && (ids.size() < ENTRY_BATCH_COUNT); i++){
+                if(const auto post = postStore.get(feeds[i]); post.partial){
+                        ids.emplace_back(post.id);
+                }
+        }
+
+        return ids;
+}
+// Fetches the given entries on the handle of background tasks, without
+// touching the loaded posts; completePosts puts them in.
+std::map<std::string, PostData> FeedlyProvider::fetchPosts(const std::vector<std::string>& ids){
+        return fetchPosts(taskCurl, ids);
+}
+std::map<std::string, PostData> FeedlyProvider::fetchPosts(CURL* handle, const std::vector<std::string>& ids){
+        Json::Value request(Json::arrayValue);
+        for(const auto& id : ids){
+                request.append(id);
+        }
 
         try{
-                curl_retrieve("markers", jsonCont);
+                auto body = std::string{};
+                return fetchEntries(handle, body, request);
         }
         catch(const std::exception& e){
-                openLogStream();
-                log_stream << "Could not mark post(s) as saved" << std::endl;
-                log_stream << e.what() << std::endl;
+                logMessage("Could not get posts\n"s + e.what());
                 throw;
         }
 }
-void FeedlyProvider::markPostsUnsaved(const std::vector<std::string>& ids){
+// Completes the partial posts of ids with the entries fetched for them and
+// returns the indices of those in the loaded stream.
+std::vector<size_t> FeedlyProvider::completePosts(const std::vector<std::string>& ids, std::map<std::string, PostData>&& loaded){
+        auto completed = std::set<PostHandle>{};
+        for(const auto& id : ids){
+                const auto handle = postStore.find(id);
+                if((handle == nullptr) || !postStore.get(*handle).partial){
+                        continue;
+                }
+
+                auto post = PostData{};
+                post.id = id;
+                if(const auto it = loaded.find(id); it != loaded.end()){
+                        post = std::move(it->second);
+                }
+                else{
+                        // Deleted since its id was listed; do not ask for it again.
+                        post.title = "[Entry not available]";
+                }
+                postStore.replace(*handle, post);
+                completed.insert(*handle);
+        }
+
+        auto indices = std::vector<size_t>{};
+        for(size_t i = 0; i < feeds.size(); i++){
+                if(completed.count(feeds[i]) > 0){
+                        indices.push_back(i);
+                }
+        }
+
+        return indices;
+}
+// Fetches one page of a stream and returns its continuation token.
+std::string FeedlyProvider::fetchStream(CURL* handle, const std::string& id, const std::string& rank, unsigned int count, const std::string& continuation, const PostCallback& onPost, long long newerThan){
+        auto parser = StreamParser(onPost);
+        curl_stream(handle, streamUri(handle, id, rank, count, continuation, newerThan), parser);
+
+        return parser.getContinuation();
+}
+std::string FeedlyProvider::streamUri(CURL* handle, const std::string& id, const std::string& rank, unsigned int count, const std::string& continuation, long long newerThan){
+        const auto escapedId = escapeCurlString(handle, id);
+        auto uri = "streams/contents?ranked="s + rank + "&count=" + std::to_string(count) + "&unreadOnly=true&streamId=" + escapedId.get();
+        if(!continuation.empty()){
+                const auto escapedContinuation = escapeCurlString(handle, continuation);
+                uri += "&continuation="s + escapedContinuation.get();
+        }
+        if(newerThan > 0){
+                uri += "&newerThan=" + std::to_string(newerThan);
+        }
+
+        return uri;
+}
+// Queues the first page of the given categories for background fetching.
+// Requests that have not started yet are replaced, as they are usually
+// the neighbours of a cursor position the user has already left.
+void FeedlyProvider::prefetchStreams(const std::vector<std::string>& categories, bool whichRank){
+        if(idsFirst || prefetchConcurrency == 0 || prefetchMemoryLimit == 0){
+                return;
+        }
+
+        auto lock = std::lock_guard(prefetchMutex);
+        prefetchQueue.clear();
+        for(const auto& category : categories){
+                if(const auto it = user_data.categories.find(category); it != user_data.categories.end()){
+                        prefetchQueue.push_back({category, it->second, whichRank ? "oldest" : "newest"});
+                }
+        }
+
+        while(prefetchWorkers.size() < prefetchConcurrency){
+                prefetchWorkers.emplace_back(&FeedlyProvider::prefetchWorker, this);
+        }
+
+        prefetchCondition.notify_all();
+}
+// Fetches the first page of every category at once over a curl multi handle,
+// with at most refresh_concurrency transfers running. Each response is parsed
+// as it arrives, and the pages are kept like prefetched streams, so opening
+// any category afterwards needs no request. Returns the number of categories
+// that could not be refreshed. When loading ids first, see
+// refreshesAllStreams, only the unread counts are.
+size_t FeedlyProvider::refreshAllStreams(bool whichRank){
+        // Nothing here uses the main handle, so the loaded stream can still be
+        // read and completed while this runs on another thread.
+        try{
+                auto body = std::string{};
+                fetchUnreadCounts(taskCurl, body);
+        }
+        catch(const std::exception&){
+                // Logged already; the streams are worth refreshing without them.
+        }
+
+        if(!refreshesAllStreams()){
+                return 0;
+        }
+
+        const auto rank = whichRank ? "oldest"s : "newest"s;
+        const auto count = std::min<unsigned int>(PAGE_FCOUNT, rtrv_count);
+
+        auto pending = std::deque<std::pair<std::string, std::string>>(user_data.categories.begin(), user_data.categories.end());
+        auto idleHandles = std::vector<CURL*>{};
+        for(size_t i = 0; i < std::min<size_t>(refreshConcurrency, pending.size()); i++){
+                idleHandles.push_back(newCurlHandle());
+        }
+
+        const auto multi = CurlMulti(curl_multi_init(), &curl_multi_cleanup);
+        curl_multi_setopt(multi.get(), CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+        auto transfers = std::map<CURL*, std::unique_ptr<RefreshTransfer>>{};
+        size_t failed = 0;
+
+        const auto startTransfers = [&](){
+                while(!pending.empty() && !idleHandles.empty()){
+                        const auto handle = idleHandles.back();
+                        idleHandles.pop_back();
+
+                        const auto [label, id] = pending.front();
+                        pending.pop_front();
+
+                        auto transfer = std::make_unique<RefreshTransfer>(label, id, rank);
+                        curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, feedStreamParser);
+                        curl_easy_setopt(handle, CURLOPT_WRITEDATA, &transfer->context);
+
+                        // Wait for a connection that can be multiplexed rather than open another.
+                        curl_easy_setopt(handle, CURLOPT_PIPEWAIT, 1L);
+                        prepareRequest(handle, streamUri(handle, id, rank, count, ""));
+                        curl_multi_add_handle(multi.get(), handle);
+
+                        transfers.emplace(handle, std::move(transfer));
+                }
+        };
+
+        startTransfers();
+        while(!transfers.empty()){
+                int running = 0;
+                curl_multi_perform(multi.get(), &running);
+
+                int left = 0;
+                while(const auto message = curl_multi_info_read(multi.get(), &left)){
+                        if(message->msg != CURLMSG_DONE){
+                                continue;
+                        }
+
+                        const auto handle = message->easy_handle;
+                        const auto result = message->data.result;
+                        curl_multi_remove_handle(multi.get(), handle);
+
+                        const auto it = transfers.find(handle);
+                        auto transfer = std::move(it->second);
+                        transfers.erase(it);
+                        idleHandles.push_back(handle);
+
+                        try{
+                                if(transfer->context.error){
+                                        std::rethrow_exception(transfer->context.error);
+                                }
+                                if(result != CURLE_OK){
+                                        throw std::runtime_error("curl_easy_perform() failed: "s + curl_easy_strerror(result));
+                                }
+
+                                recordTransfer(handle, "streams/contents", transfer->context.bytes);
+                                transfer->parser.finish();
+                                transfer->stream.continuation = transfer->parser.getContinuation();
+
+                                {
+                                        auto lock = std::lock_guard(statsMutex);
+                                        transferStats.postsParsed += transfer->parser.getPostCount();
+                                        transferStats.parseTime += std::chrono::duration_cast<std::chrono::microseconds>(transfer->context.parseTime);
+                                }
+
+                                if(transfer->stream.continuation.empty()){
+                                        auto lock = std::lock_guard(countsMutex);
+                                        if(const auto counted = unreadCounts.find(transfer->streamId); counted != unreadCounts.end()){
+                                                counted->second = transfer->stream.posts.size();
+                                        }
+                                }
+
+                                auto lock = std::lock_guard(prefetchMutex);
+                                storePrefetchedStream(transfer->label, std::move(transfer->stream));
+                        }
+                        catch(const std::exception& e){
+                                failed++;
+                                logMessage("Could not refresh "s + transfer->label + "\n" + e.what());
+                        }
+                }
+
+                startTransfers();
+                if(!transfers.empty()){
+                        curl_multi_poll(multi.get(), NULL, 0, 1000, NULL);
+                }
+        }
+
+        for(const auto handle : idleHandles){
+                curl_easy_cleanup(handle);
+        }
+
+        return failed;
+}
+// Streams loaded ids first are never prefetched, since opening one only
+// fetches the bodies around the cursor.
+bool FeedlyProvider::refreshesAllStreams() const{
+        return !idsFirst;
+}
+bool FeedlyProvider::takePrefetchedStream(const std::string& category){
+        auto lock = std::lock_guard(prefetchMutex);
+
+        const auto it = prefetchedStreams.find(category);
+        if(it == prefetchedStreams.end()){
+                return false;
+        }
+
+        auto& stream = it->second;
+        const auto usable = (stream.rank == streamRank) && ((std::chrono::steady_clock::now() - stream.fetched) < PREFETCH_TTL);
+        if(usable){
+                for(const auto& post : stream.posts){
+                        feeds.push_back(addPost(post));
+                }
+                streamContinuation = stream.continuation;
+        }
+
+        prefetchedBytes -= stream.bytes;
+        prefetchedStreams.erase(it);
+
+        return usable;
+}
+// Must be called with prefetchMutex held. Evicts the oldest streams to stay
+// within prefetch_memory_limit_mb.
+void FeedlyProvider::storePrefetchedStream(const std::string& category, PrefetchedStream&& stream){
+        if(const auto it = prefetchedStreams.find(category); it != prefetchedStreams.end()){
+                prefetchedBytes -= it->second.bytes;
+                prefetchedStreams.erase(it);
+        }
+
+        if(stream.bytes > prefetchMemoryLimit){
+                return;
+        }
+
+        while(prefetchedBytes + stream.bytes > prefetchMemoryLimit){
+                const auto oldest = std::min_element(prefetchedStreams.begin(), prefetchedStreams.end(), [](const auto& a, const auto& b){
+                        return a.second.fetched < b.second.fetched;
+                });
+                prefetchedBytes -= oldest->second.bytes;
+                prefetchedStreams.erase(oldest);
+        }
+
+        prefetchedBytes += stream.bytes;
+        prefetchedStreams.emplace(category, std::move(stream));
+}
+void FeedlyProvider::prefetchWorker(){
+        const auto handle = newCurlHandle();
+        const auto count = std::min<unsigned int>(PAGE_FCOUNT, rtrv_count);
+
+        auto lock = std::unique_lock(prefetchMutex);
+        while(true){
+                prefetchCondition.wait(lock, [this]{
+                        return shuttingDown || !prefetchQueue.empty();
+                });
+                if(shuttingDown){
+                        break;
+                }
+
+                const auto request = std::move(prefetchQueue.front());
+                prefetchQueue.pop_front();
+
+                const auto cached = prefetchedStreams.find(request.label);
+                if(prefetchInFlight.count(request.label) ||
+                    ((cached != prefetchedStreams.end()) &&
+                     (cached->second.rank == request.rank) &&
+                     ((std::chrono::steady_clock::now() - cached->second.fetched) < PREFETCH_TTL))){
+                        continue;
+                }
+
+                prefetchInFlight.insert(request.label);
+                lock.unlock();
+
+                auto stream = PrefetchedStream{request.rank, {}, {}, 0, std::chrono::steady_clock::now()};
+                auto failed = false;
+                try{
+                        stream.continuation = fetchStream(handle, request.streamId, request.rank, count, "", [&stream](PostData&& post){
+                                stream.bytes += postSize(post);
+                                stream.posts.push_back(std::move(post));
+                        });
+                }
+                catch(const std::exception&){
+                        // Prefetching is best effort, the real fetch reports errors.
+                        failed = true;
+                }
+
+                lock.lock();
+                prefetchInFlight.erase(request.label);
+                if(!failed){
+                        storePrefetchedStream(request.label, std::move(stream));
+                }
+        }
+
+        lock.unlock();
+        curl_easy_cleanup(handle);
+}
+void FeedlyProvider::stopPrefetchWorkers(){
+        {
+                auto lock = std::lock_guard(prefetchMutex);
+                shuttingDown = true;
+        }
+        prefetchCondition.notify_all();
+
+        for(auto& worker : prefetchWorkers){
+                worker.join();
+        }
+        prefetchWorkers.clear();
+}
+// Queues a read/saved state change for the marker worker. The change is
+// appended to the journal first, so it survives a crash or a failed request.
+void FeedlyProvider::queueMarker(MarkerAction action, const std::string& id){
+        static const char codes[] = {'r', 'u', 's', 'S'};
+
+        auto lock = std::lock_guard(markerMutex);
+
+        if(!journalStream.is_open()){
+                journalStream.open(journalPath, std::ofstream::out | std::ofstream::app);
+        }
+        journalStream << codes[static_cast<int>(action)] << ' ' << id << '\n' << std::flush;
+
+        const auto isReadState = (action == MarkerAction::Read) || (action == MarkerAction::Unread);
+        const auto value = (action == MarkerAction::Read) || (action == MarkerAction::Saved);
+        addPendingMarker(isReadState ? pendingRead : pendingSaved, id, value);
+        if(isReadState){
+                entryStore.setUnread(id, !value);
+                adjustUnreadCounts(id, value ? -1 : 1);
+        }
+
+        if(markersDue == std::chrono::steady_clock::time_point::max()){
+                markersDue = std::chrono::steady_clock::now() + MARKER_FLUSH_INTERVAL;
+        }
+
+        if(!markerWorker.joinable()){
+                markerWorker = std::thread(&FeedlyProvider::markerLoop, this);
+        }
+
+        markerCondition.notify_all();
+}
+// An action that undoes a pending one on the same entry cancels it instead of being sent.
+void FeedlyProvider::addPendingMarker(std::map<std::string, bool>& pending, const std::string& id, bool value){
+        if(const auto it = pending.find(id); it != pending.end()){
+                if(it->second != value){
+                        pending.erase(it);
+                }
+        }
+        else{
+                pending.emplace(id, value);
+        }
+}
+// Makes one attempt to send all queued markers and waits for it to finish,
+// unless the transfers are cancelled meanwhile.
+void FeedlyProvider::flushMarkers(){
+        auto lock = std::unique_lock(markerMutex);
+        if(!markerWorker.joinable() || (pendingRead.empty() && pendingSaved.empty() && !markersSending)){
+                return;
+        }
+
+        // A cycle already in progress may have missed the latest markers.
+        const auto target = markerCycles + (markersSending ? 2 : 1);
+        flushRequested = true;
+        markerCondition.notify_all();
+        markerCondition.wait(lock, [this, target]{
+                return (markerCycles >= target) || stopMarkers || transfersCancelled;
+        });
+}
+std::vector<std::string> FeedlyProvider::takeMarkerErrors(){
+        auto lock = std::lock_guard(markerMutex);
+        auto errors = std::vector<std::string>{};
+        errors.swap(markerErrors);
+        return errors;
+}
+void FeedlyProvider::markerLoop(){
+        const auto handle = newCurlHandle();
+
+        // Queued markers must still go out while the provider shuts down, so
+        // they are only aborted once stopMarkerWorker gave up waiting.
+        curl_easy_setopt(handle, CURLOPT_XFERINFOFUNCTION, abortMarkers);
+
+        auto lock = std::unique_lock(markerMutex);
+        while(true){
+                markerCondition.wait(lock, [this]{
+                        return stopMarkers || flushRequested || !pendingRead.empty() || !pendingSaved.empty();
+                });
+                markerCondition.wait_until(lock, markersDue, [this]{
+                        return stopMarkers || flushRequested;
+                });
+
+                auto read = std::move(pendingRead);
+                auto saved = std::move(pendingSaved);
+                pendingRead.clear();
+                pendingSaved.clear();
+                flushRequested = false;
+                markersDue = std::chrono::steady_clock::time_point::max();
+                markersSending = true;
+                lock.unlock();
+
+                sendMarkers(handle, read, saved);
+
+                lock.lock();
+
+                // Whatever failed goes back in front of the markers queued meanwhile,
+                // and is retried later with an increasing delay.
+                if(!read.empty() || !saved.empty()){
+                        for(const auto& [id, value] : pendingRead){
+                                addPendingMarker(read, id, value);
+                        }
+                        for(const auto& [id, value] : pendingSaved){
+                                addPendingMarker(saved, id, value);
+                        }
+                        pendingRead = std::move(read);
+                        pendingSaved = std::move(saved);
+
+                        markersOffline = true;
+                        markersDue = std::chrono::steady_clock::now() + markerRetryInterval;
+                        markerRetryInterval = std::min<std::chrono::seconds>(markerRetryInterval * 2, MARKER_MAX_RETRY_INTERVAL);
+                }
+                else{
+                        markersOffline = false;
+                        markerRetryInterval = MARKER_RETRY_INTERVAL;
+                        if(!pendingRead.empty() || !pendingSaved.empty()){
+                                markersDue = std::chrono::steady_clock::now() + MARKER_FLUSH_INTERVAL;
+                        }
+                }
+
+                rewriteJournal();
+
+                markersSending = false;
+                markerCycles++;
+                markerCondition.notify_all();
+
+                if(stopMarkers){
+                        break;
+                }
+        }
+
+        lock.unlock();
+        curl_easy_cleanup(handle);
+}
+// Sends one request per action type. Markers that could not be sent are
+// left in read and saved, the others are removed.
+void FeedlyProvider::sendMarkers(CURL* handle, std::map<std::string, bool>& read, std::map<std::string, bool>& saved){
+        auto batches = std::map<std::string, std::vector<std::string>>{};
+        for(const auto& [id, isRead] : read){
+                batches[isRead ? "markAsRead" : "keepUnread"].push_back(id);
+        }
+        for(const auto& [id, isSaved] : saved){
+                batches[isSaved ? "markAsSaved" : "markAsUnsaved"].push_back(id);
+        }
+
+        for(const auto& [action, ids] : batches){
+                try{
+                        postEntryMarkers(handle, action, ids);
+
+                        auto& sent = ((action == "markAsRead") || (action == "keepUnread")) ? read : saved;
+                        for(const auto& id : ids){
+                                sent.erase(id);
+                        }
+                }
+                catch(const std::exception& e){
+                        auto lock = std::lock_guard(markerMutex);
+                        markerErrors.push_back("Could not update " + std::to_string(ids.size()) + " post(s), will retry: " + e.what());
+                }
+        }
+}
+void FeedlyProvider::postEntryMarkers(CURL* handle, const std::string& action, const std::vector<std::string>& ids){
         Json::Value jsonCont;
         Json::Value array;
 
         jsonCont["type"] = "entries";
 
         for(const auto& id : ids){
-                array.append("entryIds") = id;
+                array.append(id);
         }
 
         jsonCont["entryIds"] = array;
-        jsonCont["action"] = "markAsUnsaved";
+        jsonCont["action"] = action;
 
-        try{
-                curl_retrieve("markers", jsonCont);
+        auto body = std::string{};
+        curl_request(handle, body, "markers", jsonCont);
+}
+// Loads the markers left over from a previous session and sends them in batches.
+void FeedlyProvider::replayJournal(){
+        auto journal = std::ifstream(journalPath);
+        if(!journal){
+                return;
         }
-        catch(const std::exception& e){
-                openLogStream();
-                log_stream << "Could not mark post(s) as unsaved" << std::endl;
-                log_stream << e.what() << std::endl;
-                throw;
+
+        auto lock = std::lock_guard(markerMutex);
+
+        std::string line;
+        while(std::getline(journal, line)){
+                if(line.size() < 3 || line[1] != ' '){
+                        continue;
+                }
+
+                const auto id = line.substr(2);
+                switch(line[0]){
+                        case 'r': addPendingMarker(pendingRead, id, true); entryStore.setUnread(id, false); break;
+                        case 'u': addPendingMarker(pendingRead, id, false); entryStore.setUnread(id, true); break;
+                        case 's': addPendingMarker(pendingSaved, id, true); break;
+                        case 'S': addPendingMarker(pendingSaved, id, false); break;
+                }
+        }
+
+        rewriteJournal();
+
+        if(!pendingRead.empty() || !pendingSaved.empty()){
+                flushRequested = true;
+                markerWorker = std::thread(&FeedlyProvider::markerLoop, this);
         }
 }
+// Must be called with markerMutex held. Replaces the journal with the
+// markers that are still pending.
+void FeedlyProvider::rewriteJournal(){
+        journalStream.close();
+
+        if(pendingRead.empty() && pendingSaved.empty()){
+                auto errorCode = std::error_code{};
+                fs::remove(journalPath, errorCode);
+                return;
+        }
+
+        auto temporaryPath = journalPath;
+        temporaryPath += ".tmp";
+        if(auto journal = std::ofstream(temporaryPath, std::ofstream::trunc)){
+                for(const auto& [id, isRead] : pendingRead){
+                        journal << (isRead ? 'r' : 'u') << ' ' << id << '\n';
+                }
+                for(const auto& [id, isSaved] : pendingSaved){
+                        journal << (isSaved ? 's' : 'S') << ' ' << id << '\n';
+                }
+        }
+
+        auto errorCode = std::error_code{};
+        fs::rename(temporaryPath, journalPath, errorCode);
+}
+// Called after any successful request: markers that failed earlier are
+// retried right away instead of waiting for their retry delay.
+void FeedlyProvider::markersReconnected(){
+        if(!markersOffline){
+                return;
+        }
+
+        markersOffline = false;
+
+        auto lock = std::lock_guard(markerMutex);
+        flushRequested = true;
+        markerCondition.notify_all();
+}
+void FeedlyProvider::stopMarkerWorker(){
+        {
+                auto lock = std::lock_guard(markerMutex);
+                if(!markerWorker.joinable()){
+                        return;
+                }
+                stopMarkers = true;
+        }
+        markerCondition.notify_all();
+
+        // The last markers get a moment to go out; those still pending are in
+        // the journal and will be sent on the next start.
+        {
+                auto lock = std::unique_lock(markerMutex);
+                const auto cycles = markerCycles;
+                if(!markerCondition.wait_for(lock, MARKER_SHUTDOWN_TIMEOUT, [this, cycles]{ return markerCycles != cycles; })){
+                        markersAbandoned = true;
+                }
+        }
+
+        markerWorker.join();
+}
 void FeedlyProvider::markCategoriesRead(const std::string& id, const std::string& lastReadEntryId){
         Json::Value jsonCont;
         Json::Value array;
@@ -280,11 +1452,26 @@ void FeedlyProvider::markCategoriesRead(const std::string& id, const std::string
 
         try{
                 curl_retrieve("markers", jsonCont);
+
+                // The stored unread lists no longer say which entries are unread.
+                entryStore.clearStreams();
+
+                const auto allId = user_data.categories["All"];
+                auto lock = std::lock_guard(countsMutex);
+                if(id == allId){
+                        for(auto& [category, count] : unreadCounts){
+                                count = 0;
+                        }
+                }
+                else if(const auto it = unreadCounts.find(id); it != unreadCounts.end()){
+                        if(const auto all = unreadCounts.find(allId); all != unreadCounts.end()){
+                                all->second = std::max(0, all->second - it->second);
+                        }
+                        it->second = 0;
+                }
         }
         catch(const std::exception& e){
-                openLogStream();
-                log_stream << "Could not mark category(ies) as read" << std::endl;
-                log_stream << e.what() << std::endl;
+                logMessage("Could not mark category(ies) as read\n"s + e.what());
                 throw;
         }
 }
@@ -312,15 +1499,22 @@ void FeedlyProvider::addSubscription(bool newCategory, const std::string& feed,
                 curl_retrieve("subscriptions", jsonCont);
         }
         catch(const std::exception& e){
-                openLogStream();
-                log_stream << "Could not add subscription" << std::endl;
-                log_stream << e.what() << std::endl;
+                logMessage("Could not add subscription\n"s + e.what());
                 throw;
         }
 }
 
-PostData& FeedlyProvider::getSinglePostData(int index){
-        return feeds.at(index);
+PostView FeedlyProvider::getSinglePostData(size_t index) const{
+        return postStore.get(feeds.at(index));
+}
+std::string FeedlyProvider::getPostContent(size_t index) const{
+        return postStore.content(feeds.at(index));
+}
+PackedText FeedlyProvider::getPackedPostContent(size_t index) const{
+        return postStore.packedContent(feeds.at(index));
+}
+const PostStore& FeedlyProvider::getPostStore() const{
+        return postStore;
 }
 
 const std::string FeedlyProvider::getUserId(){
@@ -328,8 +1522,7 @@ const std::string FeedlyProvider::getUserId(){
 }
 
 void FeedlyProvider::enableVerbose(){
-        if(verboseFlag)
-                curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
+        curl_easy_setopt(curl, CURLOPT_VERBOSE, verboseFlag ? 1L : 0L);
 }
 void FeedlyProvider::setVerbose(bool value){
         verboseFlag = value;
@@ -337,55 +1530,155 @@ void FeedlyProvider::setVerbose(bool value){
 void FeedlyProvider::setChangeTokensFlag(bool value){
         changeTokens = value;
 }
-Json::Value FeedlyProvider::curl_retrieve(const std::string& uri, const Json::Value& jsonCont){
-        struct curl_slist *chunk = NULL;
-
-        const auto isPost = !jsonCont.isNull();
-        if(const auto dataHolder = FileStream(fopen(tempPath.c_str(), "wb"), &fclose)){
-                chunk = curl_slist_append(chunk, ("Authorization: OAuth " + user_data.authToken).c_str());
+// While set, every transfer in progress or started fails as aborted by
+// callback, except those of the marker worker.
+void FeedlyProvider::setTransfersCancelled(bool value){
+        {
+                auto lock = std::lock_guard(markerMutex);
+                transfersCancelled = value;
+        }
 
-                curl = curl_easy_init();
-                curl_easy_setopt(curl, CURLOPT_URL, (std::string(FEEDLY_URI) + uri).c_str());
-                curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, true);
-                curl_easy_setopt(curl, CURLOPT_AUTOREFERER, true);
-                curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/4.0");
-                curl_easy_setopt(curl, CURLOPT_WRITEDATA, dataHolder.get());
-                curl_easy_setopt(curl, CURLOPT_HTTPHEADER, chunk);
+        // A task waiting in flushMarkers is cancelled as well.
+        markerCondition.notify_all();
+}
+// Progress callback of every handle: aborts transfers once the provider is
+// shutting down or the user cancelled what was loading.
+int FeedlyProvider::abortTransfer(void* clientp, curl_off_t, curl_off_t, curl_off_t, curl_off_t){
+        const auto provider = static_cast<FeedlyProvider*>(clientp);
+        return (provider->shuttingDown || provider->transfersCancelled) ? 1 : 0;
+}
+int FeedlyProvider::abortMarkers(void* clientp, curl_off_t, curl_off_t, curl_off_t, curl_off_t){
+        return static_cast<FeedlyProvider*>(clientp)->markersAbandoned ? 1 : 0;
+}
+const TransferStats& FeedlyProvider::getTransferStats() const{
+        return transferStats;
+}
+// Creates an easy handle attached to the shared DNS and TLS session caches.
+CURL* FeedlyProvider::newCurlHandle(){
+        const auto handle = curl_easy_init();
+        curl_easy_setopt(handle, CURLOPT_SHARE, curlShare);
+        curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(handle, CURLOPT_AUTOREFERER, 1L);
+        curl_easy_setopt(handle, CURLOPT_USERAGENT, "Feednix");
+
+        // Let libcurl offer every content encoding it was built with (gzip,
+        // deflate and brotli if available), and HTTP/2 over TLS.
+        curl_easy_setopt(handle, CURLOPT_ACCEPT_ENCODING, "");
+        curl_easy_setopt(handle, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+        curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(handle, CURLOPT_DNS_CACHE_TIMEOUT, 600L);
+        curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT, 15L);
+        // A stalled transfer would otherwise wait forever.
+        curl_easy_setopt(handle, CURLOPT_LOW_SPEED_LIMIT, 1L);
+        curl_easy_setopt(handle, CURLOPT_LOW_SPEED_TIME, 30L);
+        curl_easy_setopt(handle, CURLOPT_NOPROGRESS, 0L);
+        curl_easy_setopt(handle, CURLOPT_XFERINFOFUNCTION, abortTransfer);
+        curl_easy_setopt(handle, CURLOPT_XFERINFODATA, this);
+
+        return handle;
+}
+void FeedlyProvider::curl_perform(CURL* handle, const std::string& uri, const Json::Value& jsonCont){
+        prepareRequest(handle, uri, jsonCont);
+        performRequest(handle);
+}
+void FeedlyProvider::performRequest(CURL* handle){
+        const auto result = curl_easy_perform(handle);
+        if(result != CURLE_OK){
+                throw std::runtime_error("curl_easy_perform() failed: "s + curl_easy_strerror(result));
+        }
+}
+void FeedlyProvider::prepareRequest(CURL* handle, const std::string& uri, const Json::Value& jsonCont){
+        curl_easy_setopt(handle, CURLOPT_URL, (std::string(FEEDLY_URI) + uri).c_str());
 
-                if(isPost){
-                        Json::StyledWriter writer;
-                        std::string document = writer.write(jsonCont);
-                        curl_easy_setopt(curl, CURLOPT_POST, true);
-                        curl_easy_setopt(curl, CURLOPT_COPYPOSTFIELDS, document.c_str());
-                        chunk = curl_slist_append(chunk, "Content-Type: application/json");
-                }
+        if(!jsonCont.isNull()){
+                Json::StyledWriter writer;
+                std::string document = writer.write(jsonCont);
+                curl_easy_setopt(handle, CURLOPT_COPYPOSTFIELDS, document.c_str());
+                curl_easy_setopt(handle, CURLOPT_HTTPHEADER, postHeaders);
+        }
+        else{
+                curl_easy_setopt(handle, CURLOPT_HTTPGET, 1L);
+                curl_easy_setopt(handle, CURLOPT_HTTPHEADER, getHeaders);
+        }
 
+        if(handle == curl){
                 enableVerbose();
-
-                curl_res = curl_easy_perform(curl);
-                if(curl_res != CURLE_OK){
-                        throw std::runtime_error("curl_easy_perform() failed: "s + curl_easy_strerror(curl_res));
-                }
+        }
+}
+// Bookkeeping after a successful transfer on any handle. decodedBytes is the
+// size of the body as handed to the write callback.
+void FeedlyProvider::recordTransfer(CURL* handle, const std::string& uri, size_t decodedBytes){
+        markersReconnected();
+
+        long newConnections = 0;
+        long headerBytes = 0;
+        long httpVersion = 0;
+        curl_off_t bodyBytes = 0;
+        curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &newConnections);
+        curl_easy_getinfo(handle, CURLINFO_HEADER_SIZE, &headerBytes);
+        curl_easy_getinfo(handle, CURLINFO_SIZE_DOWNLOAD_T, &bodyBytes);
+        curl_easy_getinfo(handle, CURLINFO_HTTP_VERSION, &httpVersion);
+
+        auto lock = std::lock_guard(statsMutex);
+        transferStats.requests++;
+        if(newConnections > 0){
+                transferStats.connectionsOpened += newConnections;
         }
         else{
-                throw std::runtime_error("Failed to open the temporary file stream: "s + strerror(errno));
+                transferStats.connectionsReused++;
+        }
+        if(httpVersion >= CURL_HTTP_VERSION_2_0){
+                transferStats.http2Requests++;
         }
 
-        curl_easy_cleanup(curl);
+        auto& endpoint = transferStats.endpoints[uri.substr(0, uri.find('?'))];
+        endpoint.requests++;
+        endpoint.wireBytes += headerBytes + bodyBytes;
+        endpoint.decodedBytes += decodedBytes;
+}
+Json::Value FeedlyProvider::curl_retrieve(const std::string& uri, const Json::Value& jsonCont){
+        return curl_request(curl, responseBody, uri, jsonCont);
+}
+// Performs a request on any handle and parses the body collected in body.
+Json::Value FeedlyProvider::curl_request(CURL* handle, std::string& body, const std::string& uri, const Json::Value& jsonCont){
+        // The body buffer keeps its capacity between requests, so a refresh
+        // only allocates once it outgrows the previous response.
+        body.clear();
+
+        curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, appendToBuffer);
+        curl_easy_setopt(handle, CURLOPT_WRITEDATA, &body);
 
-        if(isPost){
-                return Json::Value();
+        curl_perform(handle, uri, jsonCont);
+        recordTransfer(handle, uri, body.size());
+
+        if(dumpResponses){
+                dumpResponse(uri, body);
         }
 
-        std::ifstream data(tempPath.c_str(), std::ifstream::binary);
-        if(!data){
-                throw std::runtime_error("Failed to open a temporary file: " + tempPath.native());
+        Json::Reader reader;
+        Json::Value root;
+        if(!jsonCont.isNull()){
+                // POST bodies are only inspected for errors.
+                long status = 0;
+                curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &status);
+                if(status < 400){
+                        return Json::Value();
+                }
+                if(reader.parse(body.data(), body.data() + body.size(), root) && root.isObject() && root.isMember("errorMessage")){
+                        throw std::runtime_error("Feedly returned an error: "s
+                            + root["errorMessage"].asString()
+                            + " ("s + root["errorId"].asString() + ")"s);
+                }
+                throw std::runtime_error("Feedly returned HTTP status " + std::to_string(status));
         }
 
+        return parseResponse(body);
+}
+Json::Value FeedlyProvider::parseResponse(const std::string& body){
         Json::Reader reader;
         Json::Value root;
-        if(!reader.parse(data, root)){
-                throw std::runtime_error("Failed to parse tokens file: "s + reader.getFormattedErrorMessages());
+        if(!reader.parse(body.data(), body.data() + body.size(), root)){
+                throw std::runtime_error("Failed to parse response: "s + reader.getFormattedErrorMessages());
         }
 
         if(root.isObject() && root.isMember("errorMessage") && root.isMember("errorId")){
@@ -397,6 +1690,121 @@ Json::Value FeedlyProvider::curl_retrieve(const std::string& uri, const Json::Va
 
         return root;
 }
+// GET for resources that seldom change. The validators
+// of the cached copy go along with the request, and a 304 Not Modified is
+// answered with the cached body instead of downloading it again.
+Json::Value FeedlyProvider::curl_revalidate(CURL* handle, std::string& body, const std::string& uri){
+        const auto cached = httpCache.find(uri);
+
+        auto headers = static_cast<struct curl_slist*>(NULL);
+        for(auto header = getHeaders; header != NULL; header = header->next){
+                headers = curl_slist_append(headers, header->data);
+        }
+        if(cached != nullptr && !cached->etag.empty()){
+                headers = curl_slist_append(headers, ("If-None-Match: " + cached->etag).c_str());
+        }
+        if(cached != nullptr && !cached->lastModified.empty()){
+                headers = curl_slist_append(headers, ("If-Modified-Since: " + cached->lastModified).c_str());
+        }
+        const auto freeHeaders = std::unique_ptr<struct curl_slist, decltype(&curl_slist_free_all)>(headers, curl_slist_free_all);
+
+        auto response = CachedResponse{};
+        body.clear();
+        prepareRequest(handle, uri);
+        curl_easy_setopt(handle, CURLOPT_HTTPHEADER, headers);
+        curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, appendToBuffer);
+        curl_easy_setopt(handle, CURLOPT_WRITEDATA, &body);
+        curl_easy_setopt(handle, CURLOPT_HEADERFUNCTION, collectValidators);
+        curl_easy_setopt(handle, CURLOPT_HEADERDATA, &response);
+
+        // The header list and the validators do not outlive this call.
+        const auto restoreHandle = [this, handle]{
+                curl_easy_setopt(handle, CURLOPT_HEADERFUNCTION, NULL);
+                curl_easy_setopt(handle, CURLOPT_HEADERDATA, NULL);
+                curl_easy_setopt(handle, CURLOPT_HTTPHEADER, getHeaders);
+        };
+        try{
+                performRequest(handle);
+        }
+        catch(const std::exception&){
+                restoreHandle();
+                throw;
+        }
+        restoreHandle();
+        recordTransfer(handle, uri, body.size());
+
+        long status = 0;
+        curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &status);
+        {
+                auto lock = std::lock_guard(statsMutex);
+                if(cached != nullptr){
+                        transferStats.conditionalRequests++;
+                }
+                if(status == 304 && cached != nullptr){
+                        transferStats.notModified++;
+                }
+        }
+
+        if(status == 304 && cached != nullptr){
+                return parseResponse(cached->body);
+        }
+
+        if(dumpResponses){
+                dumpResponse(uri, body);
+        }
+
+        auto root = parseResponse(body);
+        if(status == 200){
+                response.body = body;
+                httpCache.store(uri, std::move(response));
+        }
+
+        return root;
+}
+// Like curl_retrieve, but the body is parsed while it downloads instead of
+// being buffered and turned into a Json::Value.
+void FeedlyProvider::curl_stream(CURL* handle, const std::string& uri, StreamParser& parser){
+        auto dump = std::string{};
+        auto context = StreamContext{&parser, dumpResponses ? &dump : NULL, nullptr, {}, 0};
+        curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, feedStreamParser);
+        curl_easy_setopt(handle, CURLOPT_WRITEDATA, &context);
+
+        try{
+                curl_perform(handle, uri);
+        }
+        catch(const std::exception&){
+                if(context.error){
+                        std::rethrow_exception(context.error);
+                }
+                throw;
+        }
+
+        recordTransfer(handle, uri, context.bytes);
+
+        if(dumpResponses){
+                dumpResponse(uri, dump);
+        }
+
+        parser.finish();
+
+        auto lock = std::lock_guard(statsMutex);
+        transferStats.postsParsed += parser.getPostCount();
+        transferStats.parseTime += std::chrono::duration_cast<std::chrono::microseconds>(context.parseTime);
+}
+// Debugging aid: keep a copy of every response body under $TMPDIR/feednix.XXXXXX.
+void FeedlyProvider::dumpResponse(const std::string& uri, const std::string& body){
+        const auto path = tempDir / ("response-" + std::to_string(++dumpCount) + ".txt");
+        if(auto dump = std::ofstream(path, std::ofstream::binary)){
+                dump << uri << "\n\n";
+                dump.write(body.data(), body.size());
+        }
+}
+// Any thread may log; the log is opened on first use.
+void FeedlyProvider::logMessage(const std::string& message){
+        auto lock = std::lock_guard(logMutex);
+        openLogStream();
+        log_stream << message << std::endl;
+}
 void FeedlyProvider::openLogStream(){
         if(!log_stream.is_open()){
                 log_stream.open(logPath, std::ofstream::out | std::ofstream::app);
@@ -421,5 +1829,69 @@ void FeedlyProvider::echo(bool on = true){
         tcsetattr( STDIN_FILENO, TCSANOW, &settings );
 }
 void FeedlyProvider::curl_cleanup(){
+        stopPrefetchWorkers();
+        stopMarkerWorker();
+#ifdef DEBUG
+        // Saving drops the entries no stored stream lists any more.
+        const auto storedEntries = entryStore.size();
+        const auto storedEntryBytes = entryStore.bytes();
+#endif
+        entryStore.save();
+        httpCache.save();
+
+#ifdef DEBUG
+        if(transferStats.requests > 0){
+                auto lock = std::lock_guard(logMutex);
+                openLogStream();
+                log_stream << "Transfers: " << transferStats.requests << " requests, "
+                        << transferStats.connectionsOpened << " connections opened, "
+                        << transferStats.connectionsReused << " reused, "
+                        << transferStats.http2Requests << " over HTTP/2" << std::endl;
+                log_stream << "HTTP cache: " << transferStats.conditionalRequests << " conditional requests, "
+                        << transferStats.notModified << " answered from the cache" << std::endl;
+                for(const auto& [endpoint, stats] : transferStats.endpoints){
+                        log_stream << "  " << endpoint << ": " << stats.requests << " requests, "
+                                << stats.wireBytes / 1024 << " kB on the wire, "
+                                << stats.decodedBytes / 1024 << " kB decoded" << std::endl;
+                }
+                log_stream << "Streams: " << transferStats.postsParsed << " posts parsed in "
+                        << transferStats.parseTime.count() / 1000 << " ms" << std::endl;
+
+                const auto postStats = postStore.getStats();
+                if(postStats.posts > 0){
+                        log_stream << "Posts: " << postStats.posts << " loaded in "
+                                << postStats.bytes / 1024 << " kB, "
+                                << postStats.bytes / postStats.posts << " bytes per post against "
+                                << postStats.postDataBytes / postStats.posts << " as PostData, "
+                                << postStats.internedStrings << " interned strings, "
+                                << postStats.compactions << " compactions" << std::endl;
+                        log_stream << "Post bodies: " << postStats.packedContentBytes / 1024 << " kB packed from "
+                                << postStats.contentBytes / 1024 << " kB" << std::endl;
+                }
+                if(storedEntries > 0){
+                        log_stream << "Entry store: " << storedEntries << " entries in "
+                                << storedEntryBytes / 1024 << " kB" << std::endl;
+                }
+                if(postStats.unpacked > 0){
+                        log_stream << "Post bodies unpacked: " << postStats.unpacked << ", in "
+                                << postStats.unpackTime.count() / postStats.unpacked << " us average, "
+                                << postStats.maxUnpackTime.count() << " us max" << std::endl;
+                }
+
+                struct rusage usage{};
+                getrusage(RUSAGE_SELF, &usage);
+                log_stream << "Peak RSS: " << usage.ru_maxrss << " kB" << std::endl;
+        }
+#endif
+
+        curl_easy_cleanup(curl);
+        curl_easy_cleanup(taskCurl);
+        curl = taskCurl = NULL;
+        curl_share_cleanup(curlShare);
+        curlShare = NULL;
+        curl_slist_free_all(getHeaders);
+        curl_slist_free_all(postHeaders);
+        getHeaders = postHeaders = NULL;
+
         curl_global_cleanup();
 }
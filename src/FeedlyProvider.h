@@ -1,20 +1,50 @@
 #include <curl/curl.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <json/json.h>
 #include <filesystem>
+#include <functional>
 #include <string>
 #include <iostream>
 #include <filesystem>
 #include <fstream>
 #include <map>
+#include <mutex>
+#include <set>
+#include <thread>
 #include <vector>
 
 #define DEFAULT_FCOUNT 500
+#define MAX_FCOUNT 10000
+#define FIRST_PAGE_FCOUNT 20
+#define PAGE_FCOUNT 250
+#define IDS_PAGE_FCOUNT 1000
+#define ENTRY_BATCH_COUNT 50
+#define ENTRY_LOAD_MARGIN 20
+#define NEW_POST_INDEX static_cast<size_t>(-1)
+#define DEFAULT_PREFETCH_CONCURRENCY 2
+#define DEFAULT_PREFETCH_MEMORY_MB 32
+#define DEFAULT_REFRESH_CONCURRENCY 6
+#define PREFETCH_TTL std::chrono::minutes(2)
+#define MARKER_FLUSH_INTERVAL std::chrono::seconds(2)
+#define MARKER_RETRY_INTERVAL std::chrono::seconds(15)
+#define MARKER_MAX_RETRY_INTERVAL std::chrono::minutes(5)
+#define MARKER_SHUTDOWN_TIMEOUT std::chrono::seconds(3)
 #define FEEDLY_URI "https://cloud.feedly.com/v3/"
 
 #ifndef _PROVIDER_H_
 #define _PROVIDER_H_
 
+#include "EntryStore.h"
+#include "HttpCache.h"
+#include "PostData.h"
+#include "PostStore.h"
+
 using CurlString = std::unique_ptr<char, decltype(&curl_free)>;
+using CurlHandle = std::unique_ptr<CURL, decltype(&curl_easy_cleanup)>;
 
 struct UserData{
         std::map<std::string, std::string> categories;
@@ -25,51 +55,213 @@ struct UserData{
         std::string galx;
 };
 
-struct PostData{
-        std::string content;
-        std::string title;
-        std::string id;
-        std::string originURL;
-        std::string originTitle;
+// Response sizes of one kind of request: what came over the network, headers
+// included, against the body after content decoding.
+struct EndpointStats{
+        unsigned long requests{};
+        unsigned long long wireBytes{};
+        unsigned long long decodedBytes{};
+};
+
+struct TransferStats{
+        unsigned long requests{};
+        unsigned long connectionsOpened{};
+        unsigned long connectionsReused{};
+        unsigned long http2Requests{};
+        unsigned long conditionalRequests{};
+        unsigned long notModified{};
+        unsigned long postsParsed{};
+        std::chrono::microseconds parseTime{};
+        std::map<std::string, EndpointStats> endpoints;
+};
+
+enum class MarkerAction{
+        Read,
+        Unread,
+        Saved,
+        Unsaved
+};
+
+// First page of a category stream fetched in the background before the
+// user asked for it.
+struct PrefetchedStream{
+        std::string rank;
+        std::vector<PostData> posts;
+        std::string continuation;
+        size_t bytes{};
+        std::chrono::steady_clock::time_point fetched;
 };
 
+// The posts following the loaded ones, fetched without touching them so the
+// posts in use stay valid until the page is appended. A page is either whole
+// entries, or the ids of its entries along with those that were not loaded
+// for any stream yet.
+struct StreamPage{
+        std::vector<PostData> posts;
+        std::vector<std::string> ids;
+        std::map<std::string, PostData> added;
+        std::string continuation;
+};
+
+// The loaded part of the stream as it is now, fetched by fetchStreamChanges.
+// Only the posts that were not loaded come with their body.
+struct StreamChanges{
+        std::vector<std::string> ids;
+        std::map<std::string, PostData> added;
+        std::string continuation;
+};
+
+struct PrefetchRequest{
+        std::string label;
+        std::string streamId;
+        std::string rank;
+};
+
+class StreamParser;
+
 class FeedlyProvider{
         public:
                 FeedlyProvider(const std::filesystem::path& tmpDir);
                 void authenticateUser();
-                void markPostsRead(const std::vector<std::string>& ids);
-                void markPostsSaved(const std::vector<std::string>& ids);
-                void markPostsUnsaved(const std::vector<std::string>& ids);
                 void markCategoriesRead(const std::string& id, const std::string& lastReadEntryId);
-                void markPostsUnread(const std::vector<std::string>& ids);
+                void queueMarker(MarkerAction action, const std::string& id);
+                void flushMarkers();
+                std::vector<std::string> takeMarkerErrors();
                 void addSubscription(bool newCategory, const std::string& feed, std::vector<std::string> categories, const std::string& title = "");
-                const std::vector<PostData>& giveStreamPosts(const std::string& category, bool whichRank = 0);
+                const std::vector<PostHandle>& giveStreamPosts(const std::string& category, bool whichRank = 0, bool usePrefetched = false);
+                void prefetchStreams(const std::vector<std::string>& categories, bool whichRank);
+                size_t refreshAllStreams(bool whichRank);
+                bool refreshesAllStreams() const;
+                const std::vector<PostHandle>& giveStoredPosts(const std::string& category, bool whichRank);
+                bool hasMorePosts() const;
+                StreamPage fetchMorePosts();
+                size_t appendPosts(StreamPage&& page);
+                StreamChanges fetchStreamChanges();
+                std::vector<size_t> applyStreamChanges(StreamChanges&& changes);
+                bool canSortLocally() const;
+                std::vector<size_t> sortPosts(bool oldestFirst, bool bySource);
+                std::vector<std::string> partialPostsAround(size_t index) const;
+                std::map<std::string, PostData> fetchPosts(const std::vector<std::string>& ids);
+                std::vector<size_t> completePosts(const std::vector<std::string>& ids, std::map<std::string, PostData>&& loaded);
                 const std::map<std::string, std::string>& getLabels();
+                std::map<std::string, std::string> fetchLabels();
+                void setLabels(std::map<std::string, std::string>&& labels);
+                void fetchUnreadCounts();
+                int getUnreadCount(const std::string& label);
                 const std::string getUserId();
-                PostData& getSinglePostData(int index);
+                PostView getSinglePostData(size_t index) const;
+                std::string getPostContent(size_t index) const;
+                PackedText getPackedPostContent(size_t index) const;
+                const PostStore& getPostStore() const;
                 void setVerbose(bool value);
                 void setChangeTokensFlag(bool value);
+                void setTransfersCancelled(bool value);
+                const TransferStats& getTransferStats() const;
+                void logMessage(const std::string& message);
                 void curl_cleanup();
         private:
-                CURL *curl;
-                CURLcode curl_res;
+                static int abortTransfer(void* clientp, curl_off_t, curl_off_t, curl_off_t, curl_off_t);
+                static int abortMarkers(void* clientp, curl_off_t, curl_off_t, curl_off_t, curl_off_t);
+                CURL *curl{};
+                // Used by the tasks that run beside the loaded stream, one at a
+                // time, so they keep their connection between requests.
+                CURL *taskCurl{};
+                CURLSH *curlShare{};
+                std::array<std::mutex, CURL_LOCK_DATA_LAST> shareLocks;
+                struct curl_slist *getHeaders{}, *postHeaders{};
+                std::mutex statsMutex;
+                TransferStats transferStats;
+                std::atomic<unsigned long> dumpCount{};
+                std::atomic<bool> shuttingDown{};
+                std::atomic<bool> transfersCancelled{};
+                unsigned int prefetchConcurrency{DEFAULT_PREFETCH_CONCURRENCY};
+                size_t prefetchMemoryLimit{DEFAULT_PREFETCH_MEMORY_MB * 1024 * 1024};
+                unsigned int refreshConcurrency{DEFAULT_REFRESH_CONCURRENCY};
+                std::vector<std::thread> prefetchWorkers;
+                std::mutex prefetchMutex;
+                std::condition_variable prefetchCondition;
+                std::deque<PrefetchRequest> prefetchQueue;
+                std::set<std::string> prefetchInFlight;
+                std::map<std::string, PrefetchedStream> prefetchedStreams;
+                size_t prefetchedBytes{};
+                std::thread markerWorker;
+                std::mutex markerMutex;
+                std::condition_variable markerCondition;
+                std::map<std::string, bool> pendingRead, pendingSaved;
+                std::chrono::steady_clock::time_point markersDue{std::chrono::steady_clock::time_point::max()};
+                std::chrono::seconds markerRetryInterval{MARKER_RETRY_INTERVAL};
+                bool flushRequested{}, markersSending{}, stopMarkers{};
+                std::atomic<bool> markersOffline{}, markersAbandoned{};
+                unsigned long markerCycles{};
+                std::vector<std::string> markerErrors;
+                std::filesystem::path journalPath;
+                std::ofstream journalStream;
+                std::mutex logMutex;
                 std::ofstream log_stream;
                 std::string feedly_url;
                 std::string userAuthCode;
-                std::string TOKEN_PATH, COOKIE_PATH, rtrv_count;
-                const std::filesystem::path tempPath;
+                std::string TOKEN_PATH, COOKIE_PATH;
+                unsigned int rtrv_count{DEFAULT_FCOUNT};
+                std::string streamId, streamRank, streamContinuation;
+                const std::filesystem::path tempDir;
                 std::filesystem::path logPath;
                 std::filesystem::path configPath;
                 UserData user_data;
-                bool verboseFlag{}, changeTokens{};
-                std::vector<PostData> feeds;
+                bool verboseFlag{}, changeTokens{}, dumpResponses{}, idsFirst{}, shareEntries{};
+                std::string responseBody;
+                PostStore postStore;
+                std::vector<PostHandle> feeds;
+                EntryStore entryStore;
+                HttpCache httpCache;
+                std::mutex countsMutex;
+                std::map<std::string, int> unreadCounts;
                 void getCookies();
                 void enableVerbose();
+                void buildAuthHeaders();
+                CURL* newCurlHandle();
+                void curl_perform(CURL* handle, const std::string& uri, const Json::Value& jsonCont = Json::Value::nullSingleton());
+                void performRequest(CURL* handle);
+                void prepareRequest(CURL* handle, const std::string& uri, const Json::Value& jsonCont = Json::Value::nullSingleton());
+                void recordTransfer(CURL* handle, const std::string& uri, size_t decodedBytes);
                 Json::Value curl_retrieve(const std::string& uri, const Json::Value& jsonCont = Json::Value::nullSingleton());
+                Json::Value curl_request(CURL* handle, std::string& body, const std::string& uri, const Json::Value& jsonCont);
+                Json::Value curl_revalidate(CURL* handle, std::string& body, const std::string& uri);
+                Json::Value parseResponse(const std::string& body);
+                void curl_stream(CURL* handle, const std::string& uri, StreamParser& parser);
+                std::string streamUri(CURL* handle, const std::string& id, const std::string& rank, unsigned int count, const std::string& continuation, long long newerThan = 0);
+                std::string fetchStream(CURL* handle, const std::string& id, const std::string& rank, unsigned int count, const std::string& continuation, const PostCallback& onPost, long long newerThan = 0);
+                StreamPage fetchPage(CURL* handle, unsigned int count);
+                std::string fetchStreamIds(CURL* handle, unsigned int count, const std::string& continuation, std::vector<std::string>& ids, long long newerThan = 0);
+                std::map<std::string, PostData> fetchEntries(CURL* handle, std::string& body, const Json::Value& ids);
+                std::map<std::string, PostData> fetchPosts(CURL* handle, const std::vector<std::string>& ids);
+                std::map<std::string, PostData> fetchMissingEntries(CURL* handle, const std::vector<std::string>& ids);
+                void fetchStreamPage(unsigned int count);
+                void fetchUnreadCounts(CURL* handle, std::string& body);
+                std::map<std::string, std::string> makeLabels(const Json::Value& root) const;
+                void updateStreamUnreadCount();
+                bool syncStoredStream();
+                PostHandle addPost(const PostData& post);
+                bool findListedPost(const std::string& id, std::map<std::string, PostData>& added, PostHandle& handle);
+                void storeStream();
+                void compactPostStore();
+                void adjustUnreadCounts(const std::string& entryId, int delta);
+                bool takePrefetchedStream(const std::string& category);
+                void storePrefetchedStream(const std::string& category, PrefetchedStream&& stream);
+                void prefetchWorker();
+                void stopPrefetchWorkers();
+                void markerLoop();
+                void addPendingMarker(std::map<std::string, bool>& pending, const std::string& id, bool value);
+                void sendMarkers(CURL* handle, std::map<std::string, bool>& read, std::map<std::string, bool>& saved);
+                void replayJournal();
+                void rewriteJournal();
+                void markersReconnected();
+                void postEntryMarkers(CURL* handle, const std::string& action, const std::vector<std::string>& ids);
+                void stopMarkerWorker();
+                void dumpResponse(const std::string& uri, const std::string& body);
                 void extract_galx_value();
                 void echo(bool on);
                 void openLogStream();
-                CurlString escapeCurlString(const std::string& s);
+                CurlString escapeCurlString(CURL* handle, const std::string& s);
 };
 
 #endif
@@ -0,0 +1,526 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <wchar.h>
+
+#include <algorithm>
+
+#include "HtmlRenderer.h"
+
+#define LIST_INDENT 4
+#define QUOTE_INDENT 4
+#define TAB_WIDTH 8
+
+static const std::map<std::string, unsigned int> ENTITIES = {
+        {"amp", '&'}, {"lt", '<'}, {"gt", '>'}, {"quot", '"'}, {"apos", '\''},
+        {"nbsp", 0xA0}, {"shy", 0xAD}, {"copy", 0xA9}, {"reg", 0xAE}, {"trade", 0x2122},
+        {"laquo", 0xAB}, {"raquo", 0xBB}, {"lsaquo", 0x2039}, {"rsaquo", 0x203A},
+        {"lsquo", 0x2018}, {"rsquo", 0x2019}, {"sbquo", 0x201A},
+        {"ldquo", 0x201C}, {"rdquo", 0x201D}, {"bdquo", 0x201E},
+        {"ndash", 0x2013}, {"mdash", 0x2014}, {"hellip", 0x2026}, {"bull", 0x2022},
+        {"middot", 0xB7}, {"deg", 0xB0}, {"times", 0xD7}, {"divide", 0xF7},
+        {"plusmn", 0xB1}, {"frac12", 0xBD}, {"frac14", 0xBC}, {"frac34", 0xBE},
+        {"euro", 0x20AC}, {"pound", 0xA3}, {"yen", 0xA5}, {"cent", 0xA2},
+        {"sect", 0xA7}, {"para", 0xB6}, {"dagger", 0x2020}, {"larr", 0x2190},
+        {"rarr", 0x2192}, {"uarr", 0x2191}, {"darr", 0x2193}, {"iexcl", 0xA1},
+        {"iquest", 0xBF}, {"eacute", 0xE9}, {"egrave", 0xE8}, {"agrave", 0xE0},
+        {"aacute", 0xE1}, {"ccedil", 0xE7}, {"ouml", 0xF6}, {"uuml", 0xFC},
+        {"auml", 0xE4}, {"szlig", 0xDF}, {"ntilde", 0xF1}, {"zwj", 0x200D},
+        {"zwnj", 0x200C}, {"ensp", 0x2002}, {"emsp", 0x2003}, {"thinsp", 0x2009},
+};
+
+static void appendCodePoint(std::string& s, unsigned int codePoint){
+        if(codePoint > 0x10FFFF || (codePoint >= 0xD800 && codePoint <= 0xDFFF)){
+                codePoint = 0xFFFD;
+        }
+
+        if(codePoint < 0x80){
+                s.push_back(static_cast<char>(codePoint));
+        }
+        else if(codePoint < 0x800){
+                s.push_back(static_cast<char>(0xC0 | (codePoint >> 6)));
+                s.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+        }
+        else if(codePoint < 0x10000){
+                s.push_back(static_cast<char>(0xE0 | (codePoint >> 12)));
+                s.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+                s.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+        }
+        else{
+                s.push_back(static_cast<char>(0xF0 | (codePoint >> 18)));
+                s.push_back(static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F)));
+                s.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+                s.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+        }
+}
+// Replaces character references with UTF-8. Unknown ones are kept as they are.
+static std::string decodeEntities(const std::string& s){
+        if(s.find('&') == std::string::npos){
+                return s;
+        }
+
+        std::string result;
+        result.reserve(s.size());
+        size_t i = 0;
+        while(i < s.size()){
+                if(s[i] != '&'){
+                        result.push_back(s[i++]);
+                        continue;
+                }
+
+                const auto end = s.find(';', i + 1);
+                auto decoded = false;
+                if(end != std::string::npos && end - i <= 10){
+                        const auto name = s.substr(i + 1, end - i - 1);
+                        if(name.size() > 1 && name[0] == '#'){
+                                const auto hex = (name[1] == 'x') || (name[1] == 'X');
+                                const auto digits = name.substr(hex ? 2 : 1);
+                                char* digitsEnd = NULL;
+                                const auto codePoint = strtoul(digits.c_str(), &digitsEnd, hex ? 16 : 10);
+                                if(!digits.empty() && isxdigit(static_cast<unsigned char>(digits[0])) && *digitsEnd == '\0'){
+                                        appendCodePoint(result, (codePoint == 0) ? 0xFFFD : codePoint);
+                                        decoded = true;
+                                }
+                        }
+                        else if(const auto it = ENTITIES.find(name); it != ENTITIES.end()){
+                                appendCodePoint(result, it->second);
+                                decoded = true;
+                        }
+                }
+
+                if(decoded){
+                        i = end + 1;
+                }
+                else{
+                        result.push_back(s[i++]);
+                }
+        }
+
+        return result;
+}
+// Decodes the UTF-8 sequence at s[i] and returns its length in bytes.
+static size_t nextCodePoint(const std::string& s, size_t i, unsigned int& codePoint){
+        const auto byte = static_cast<unsigned char>(s[i]);
+        size_t length = 1;
+        if(byte >= 0xF0){
+                codePoint = byte & 0x07;
+                length = 4;
+        }
+        else if(byte >= 0xE0){
+                codePoint = byte & 0x0F;
+                length = 3;
+        }
+        else if(byte >= 0xC0){
+                codePoint = byte & 0x1F;
+                length = 2;
+        }
+        else{
+                codePoint = byte;
+                return 1;
+        }
+
+        size_t used = 1;
+        while(used < length && i + used < s.size() && (static_cast<unsigned char>(s[i + used]) & 0xC0) == 0x80){
+                codePoint = (codePoint << 6) | (static_cast<unsigned char>(s[i + used]) & 0x3F);
+                used++;
+        }
+        if(used < length){
+                codePoint = 0xFFFD;
+        }
+
+        return used;
+}
+// Columns taken by a code point; wide CJK characters take two.
+static size_t codePointWidth(unsigned int codePoint){
+        const auto width = wcwidth(static_cast<wchar_t>(codePoint));
+        return (width < 0) ? 1 : static_cast<size_t>(width);
+}
+static size_t displayWidth(const std::string& s){
+        size_t width = 0;
+        for(size_t i = 0; i < s.size();){
+                unsigned int codePoint;
+                i += nextCodePoint(s, i, codePoint);
+                width += codePointWidth(codePoint);
+        }
+
+        return width;
+}
+static bool isSpace(char c){
+        return (c == ' ') || (c == '\t') || (c == '\n') || (c == '\r') || (c == '\f');
+}
+static bool isHeading(const std::string& name){
+        return (name.size() == 2) && (name[0] == 'h') && (name[1] >= '1') && (name[1] <= '6');
+}
+// Returns the position right after the end tag </name>, case-insensitively.
+static size_t skipElement(const std::string& html, size_t from, const std::string& name){
+        for(auto i = html.find("</", from); i != std::string::npos; i = html.find("</", i + 2)){
+                auto matches = (i + 2 + name.size() <= html.size());
+                for(size_t j = 0; matches && j < name.size(); j++){
+                        matches = (tolower(static_cast<unsigned char>(html[i + 2 + j])) == name[j]);
+                }
+                if(matches){
+                        const auto end = html.find('>', i);
+                        return (end == std::string::npos) ? html.size() : end + 1;
+                }
+        }
+
+        return html.size();
+}
+
+HtmlRenderer::HtmlRenderer(size_t columns):
+        columns{std::max<size_t>(columns, 10)}{
+}
+std::string HtmlRenderer::render(const std::string& html){
+        output.clear();
+        line.clear();
+        word.clear();
+        lineWidth = indent = 0;
+        marker.clear();
+        pendingSpace = preStart = false;
+        preDepth = 0;
+        lists.clear();
+        links.clear();
+        openLinks.clear();
+
+        size_t i = 0;
+        while(i < html.size()){
+                if(html[i] == '<' && i + 1 < html.size()){
+                        const auto c = html[i + 1];
+                        if(isalpha(static_cast<unsigned char>(c)) || (c == '/') || (c == '!') || (c == '?')){
+                                i = parseTag(html, i);
+                                continue;
+                        }
+                }
+
+                // A '<' that does not start a tag is plain text.
+                auto end = html.find('<', i + 1);
+                if(end == std::string::npos){
+                        end = html.size();
+                }
+                text(decodeEntities(html.substr(i, end - i)));
+                i = end;
+        }
+
+        breakBlock(false);
+        if(!links.empty()){
+                breakBlock(true);
+                output += "References:\n\n";
+                for(size_t n = 0; n < links.size(); n++){
+                        output += "[" + std::to_string(n + 1) + "] " + links[n] + "\n";
+                }
+        }
+
+        while(!output.empty() && output.back() == '\n'){
+                output.pop_back();
+        }
+
+        return std::move(output);
+}
+size_t HtmlRenderer::parseTag(const std::string& html, size_t start){
+        size_t i = start + 1;
+        if(html[i] == '!' || html[i] == '?'){
+                if(html.compare(i, 3, "!--") == 0){
+                        const auto end = html.find("-->", i + 3);
+                        return (end == std::string::npos) ? html.size() : end + 3;
+                }
+
+                const auto end = html.find('>', i);
+                return (end == std::string::npos) ? html.size() : end + 1;
+        }
+
+        const auto closing = (html[i] == '/');
+        if(closing){
+                i++;
+        }
+
+        std::string name;
+        while(i < html.size() && isalnum(static_cast<unsigned char>(html[i]))){
+                name.push_back(tolower(static_cast<unsigned char>(html[i++])));
+        }
+
+        Attributes attributes;
+        while(i < html.size() && html[i] != '>'){
+                if(isSpace(html[i]) || html[i] == '/'){
+                        i++;
+                        continue;
+                }
+
+                std::string attribute;
+                while(i < html.size() && !isSpace(html[i]) && html[i] != '=' && html[i] != '>' && html[i] != '/'){
+                        attribute.push_back(tolower(static_cast<unsigned char>(html[i++])));
+                }
+                while(i < html.size() && isSpace(html[i])){
+                        i++;
+                }
+
+                std::string value;
+                if(i < html.size() && html[i] == '='){
+                        i++;
+                        while(i < html.size() && isSpace(html[i])){
+                                i++;
+                        }
+
+                        if(i < html.size() && (html[i] == '"' || html[i] == '\'')){
+                                const auto end = html.find(html[i], i + 1);
+                                value = html.substr(i + 1, (end == std::string::npos) ? std::string::npos : end - i - 1);
+                                i = (end == std::string::npos) ? html.size() : end + 1;
+                        }
+                        else{
+                                while(i < html.size() && !isSpace(html[i]) && html[i] != '>'){
+                                        value.push_back(html[i++]);
+                                }
+                        }
+                }
+
+                if(!attribute.empty()){
+                        attributes[attribute] = decodeEntities(value);
+                }
+        }
+
+        const auto next = (i < html.size()) ? i + 1 : html.size();
+        if(closing){
+                endTag(name);
+                return next;
+        }
+
+        // Nothing inside these is meant to be read.
+        if(name == "script" || name == "style" || name == "head" || name == "title"){
+                return skipElement(html, next, name);
+        }
+
+        startTag(name, attributes);
+        return next;
+}
+void HtmlRenderer::startTag(const std::string& name, const Attributes& attributes){
+        const auto attribute = [&attributes](const char* key){
+                const auto it = attributes.find(key);
+                return (it != attributes.end()) ? it->second : std::string{};
+        };
+
+        if(name == "br"){
+                flushWord();
+                if(line.empty()){
+                        output.push_back('\n');
+                }
+                else{
+                        endLine();
+                }
+        }
+        else if(name == "p" || isHeading(name) || name == "table" || name == "figure" || name == "dl"){
+                breakBlock(true);
+        }
+        else if(name == "blockquote"){
+                breakBlock(true);
+                indent += QUOTE_INDENT;
+        }
+        else if(name == "ul" || name == "ol"){
+                breakBlock(lists.empty());
+                const auto first = atoi(attribute("start").c_str());
+                lists.push_back({name == "ol", (first > 0) ? static_cast<unsigned int>(first) : 1});
+                indent += LIST_INDENT;
+        }
+        else if(name == "li"){
+                breakBlock(false);
+                if(!lists.empty() && lists.back().ordered){
+                        marker = std::to_string(lists.back().next++) + ". ";
+                }
+                else{
+                        marker = "* ";
+                }
+        }
+        else if(name == "pre"){
+                breakBlock(true);
+                preDepth++;
+                preStart = true;
+        }
+        else if(name == "hr"){
+                breakBlock(false);
+                startLine();
+                line.append(columns - std::min(columns, lineWidth), '-');
+                endLine();
+        }
+        else if(name == "div" || name == "tr" || name == "dt" || name == "dd" || name == "figcaption" ||
+            name == "caption" || name == "section" || name == "article" || name == "header" || name == "footer"){
+                breakBlock(false);
+        }
+        else if(name == "td" || name == "th"){
+                flushWord();
+                pendingSpace = true;
+        }
+        else if(name == "a"){
+                openLinks.push_back(attribute("href"));
+        }
+        else if(name == "img"){
+                if(const auto alt = attribute("alt"); !alt.empty()){
+                        text(" [" + alt + "] ");
+                }
+        }
+}
+void HtmlRenderer::endTag(const std::string& name){
+        if(name == "p" || isHeading(name) || name == "table" || name == "figure" || name == "dl"){
+                breakBlock(true);
+        }
+        else if(name == "blockquote"){
+                breakBlock(true);
+                indent -= std::min<size_t>(indent, QUOTE_INDENT);
+        }
+        else if(name == "ul" || name == "ol"){
+                if(!lists.empty()){
+                        lists.pop_back();
+                        indent -= std::min<size_t>(indent, LIST_INDENT);
+                }
+                breakBlock(lists.empty());
+        }
+        else if(name == "pre"){
+                breakBlock(true);
+                if(preDepth > 0){
+                        preDepth--;
+                }
+        }
+        else if(name == "li" || name == "div" || name == "tr" || name == "dt" || name == "dd" || name == "figcaption" ||
+            name == "caption" || name == "section" || name == "article" || name == "header" || name == "footer"){
+                breakBlock(false);
+        }
+        else if(name == "a" && !openLinks.empty()){
+                const auto href = openLinks.back();
+                openLinks.pop_back();
+                if(href.empty() || href[0] == '#' || href.compare(0, 11, "javascript:") == 0){
+                        return;
+                }
+
+                auto it = std::find(links.begin(), links.end(), href);
+                if(it == links.end()){
+                        it = links.insert(links.end(), href);
+                }
+                appendWord("[" + std::to_string(it - links.begin() + 1) + "]");
+        }
+}
+void HtmlRenderer::text(const std::string& s){
+        if(preDepth > 0){
+                preformattedText(s);
+                return;
+        }
+
+        for(const auto c : s){
+                if(isSpace(c)){
+                        flushWord();
+                        pendingSpace = true;
+                }
+                else if(static_cast<unsigned char>(c) >= 0x20 && c != 0x7F){
+                        word.push_back(c);
+                }
+        }
+}
+// Text inside <pre> keeps its line breaks and spacing and is not wrapped.
+void HtmlRenderer::preformattedText(const std::string& s){
+        for(const auto c : s){
+                if(c == '\n'){
+                        // The line break right after <pre> is not part of the content.
+                        if(preStart){
+                                preStart = false;
+                                continue;
+                        }
+                        if(line.empty()){
+                                startLine();
+                        }
+                        endLine();
+                        continue;
+                }
+
+                preStart = false;
+                if(line.empty()){
+                        startLine();
+                }
+                if(c == '\t'){
+                        const auto spaces = TAB_WIDTH - ((lineWidth - indent) % TAB_WIDTH);
+                        line.append(spaces, ' ');
+                        lineWidth += spaces;
+                }
+                else if(static_cast<unsigned char>(c) >= 0x20 && c != 0x7F){
+                        line.push_back(c);
+                        if((static_cast<unsigned char>(c) & 0xC0) != 0x80){
+                                lineWidth++;
+                        }
+                }
+        }
+}
+void HtmlRenderer::appendWord(const std::string& s){
+        word.append(s);
+}
+// Puts the word collected so far on the current line, wrapping before it if
+// it does not fit and splitting it if it is wider than a whole line.
+void HtmlRenderer::flushWord(){
+        if(word.empty()){
+                return;
+        }
+
+        const auto wordWidth = displayWidth(word);
+        if(!line.empty()){
+                const auto space = pendingSpace ? 1 : 0;
+                if(lineWidth + space + wordWidth > columns){
+                        endLine();
+                }
+                else if(space){
+                        line.push_back(' ');
+                        lineWidth++;
+                }
+        }
+        if(line.empty()){
+                startLine();
+        }
+
+        const auto lineStart = lineWidth;
+        for(size_t i = 0; i < word.size();){
+                unsigned int codePoint;
+                const auto length = nextCodePoint(word, i, codePoint);
+                const auto width = codePointWidth(codePoint);
+                if(lineWidth + width > columns && lineWidth > lineStart){
+                        endLine();
+                        startLine();
+                }
+
+                line.append(word, i, length);
+                lineWidth += width;
+                i += length;
+        }
+
+        word.clear();
+        pendingSpace = false;
+}
+// Starts a line with the indentation of the current block, or with the
+// marker of the list item it opens.
+void HtmlRenderer::startLine(){
+        const auto width = std::min(indent, columns / 2);
+        if(marker.empty()){
+                line.assign(width, ' ');
+        }
+        else{
+                line.assign(width - std::min(width, marker.size()), ' ');
+                line.append(marker);
+                marker.clear();
+        }
+        lineWidth = displayWidth(line);
+}
+void HtmlRenderer::endLine(){
+        while(!line.empty() && line.back() == ' '){
+                line.pop_back();
+        }
+
+        output.append(line);
+        output.push_back('\n');
+        line.clear();
+        lineWidth = 0;
+        pendingSpace = false;
+}
+// Ends the current line, and leaves an empty one before the next block if
+// blankLine is set.
+void HtmlRenderer::breakBlock(bool blankLine){
+        flushWord();
+        if(!line.empty()){
+                endLine();
+        }
+        if(blankLine && !output.empty() && (output.size() < 2 || output.compare(output.size() - 2, 2, "\n\n") != 0)){
+                output.push_back('\n');
+        }
+
+        pendingSpace = false;
+}
@@ -0,0 +1,45 @@
+#include <map>
+#include <string>
+#include <vector>
+
+#ifndef _HTML_RENDERER_H_
+#define _HTML_RENDERER_H_
+
+// Turns the summary HTML of a post into plain text wrapped at a given width,
+// for the preview window. It understands the markup Feedly summaries are made
+// of (paragraphs, headings, lists, quotes, links, images, pre blocks and
+// entities) and ignores everything else.
+class HtmlRenderer{
+        public:
+                explicit HtmlRenderer(size_t columns);
+                std::string render(const std::string& html);
+        private:
+                using Attributes = std::map<std::string, std::string>;
+                struct List{
+                        bool ordered;
+                        unsigned int next;
+                };
+
+                const size_t columns;
+                std::string output, line, word;
+                size_t lineWidth{};
+                size_t indent{};
+                std::string marker;
+                bool pendingSpace{}, preStart{};
+                unsigned int preDepth{};
+                std::vector<List> lists;
+                std::vector<std::string> links, openLinks;
+
+                size_t parseTag(const std::string& html, size_t start);
+                void startTag(const std::string& name, const Attributes& attributes);
+                void endTag(const std::string& name);
+                void text(const std::string& s);
+                void preformattedText(const std::string& s);
+                void appendWord(const std::string& s);
+                void flushWord();
+                void startLine();
+                void endLine();
+                void breakBlock(bool blankLine);
+};
+
+#endif
@@ -0,0 +1,86 @@
+#include <json/json.h>
+#include <json/writer.h>
+
+#include <fstream>
+
+#include "HttpCache.h"
+
+namespace fs = std::filesystem;
+
+HttpCache::HttpCache(const fs::path& path):
+        cachePath{path}{
+}
+void HttpCache::load(){
+        responses.clear();
+        dirty = false;
+
+        auto file = std::ifstream(cachePath, std::ifstream::binary);
+        Json::Value root;
+        Json::Reader reader;
+
+        // An unreadable cache only costs a full download.
+        if(!file || !reader.parse(file, root) || !root.isObject()){
+                return;
+        }
+
+        for(const auto& uri : root.getMemberNames()){
+                const auto& item = root[uri];
+                if(!item.isObject() || !item["body"].isString()){
+                        continue;
+                }
+
+                auto response = CachedResponse{};
+                response.etag = item["etag"].asString();
+                response.lastModified = item["lastModified"].asString();
+                response.body = item["body"].asString();
+                if(!response.etag.empty() || !response.lastModified.empty()){
+                        responses.emplace(uri, std::move(response));
+                }
+        }
+}
+void HttpCache::save(){
+        if(!dirty){
+                return;
+        }
+
+        Json::Value root(Json::objectValue);
+        for(const auto& [uri, response] : responses){
+                auto& item = root[uri];
+                item["etag"] = response.etag;
+                item["lastModified"] = response.lastModified;
+                item["body"] = response.body;
+        }
+
+        auto temporaryPath = cachePath;
+        temporaryPath += ".tmp";
+        {
+                auto file = std::ofstream(temporaryPath, std::ofstream::binary | std::ofstream::trunc);
+                Json::FastWriter writer;
+                file << writer.write(root);
+                if(!file){
+                        return;
+                }
+        }
+
+        auto errorCode = std::error_code{};
+        fs::rename(temporaryPath, cachePath, errorCode);
+        dirty = static_cast<bool>(errorCode);
+}
+const CachedResponse* HttpCache::find(const std::string& uri) const{
+        const auto it = responses.find(uri);
+        return (it != responses.end()) ? &it->second : nullptr;
+}
+// Responses without validators cannot be revalidated and are not kept.
+void HttpCache::store(const std::string& uri, CachedResponse&& response){
+        if(response.etag.empty() && response.lastModified.empty()){
+                dirty = (responses.erase(uri) > 0) || dirty;
+                return;
+        }
+
+        responses[uri] = std::move(response);
+        dirty = true;
+}
+void HttpCache::clear(){
+        dirty = !responses.empty() || dirty;
+        responses.clear();
+}
@@ -0,0 +1,31 @@
+#include <filesystem>
+#include <map>
+#include <string>
+
+#ifndef _HTTP_CACHE_H_
+#define _HTTP_CACHE_H_
+
+struct CachedResponse{
+        std::string etag;
+        std::string lastModified;
+        std::string body;
+};
+
+// Bodies of GET responses that rarely change, with the validators needed to
+// ask Feedly whether they did. Kept as one JSON file between sessions, so the
+// first request after startup can already be answered with 304 Not Modified.
+class HttpCache{
+        public:
+                explicit HttpCache(const std::filesystem::path& path);
+                void load();
+                void save();
+                const CachedResponse* find(const std::string& uri) const;
+                void store(const std::string& uri, CachedResponse&& response);
+                void clear();
+        private:
+                const std::filesystem::path cachePath;
+                std::map<std::string, CachedResponse> responses;
+                bool dirty{};
+};
+
+#endif
@@ -0,0 +1,23 @@
+#include <functional>
+#include <string>
+#include <vector>
+
+#ifndef _POST_DATA_H_
+#define _POST_DATA_H_
+
+struct PostData{
+        std::string content;
+        std::string title;
+        std::string id;
+        std::string originURL;
+        std::string originTitle;
+        long long published{};
+        long long crawled{};
+        std::vector<std::string> categories;
+        // Only the id is known yet, see FeedlyProvider::partialPostsAround.
+        bool partial{};
+};
+
+using PostCallback = std::function<void(PostData&&)>;
+
+#endif
@@ -0,0 +1,162 @@
+#include <algorithm>
+
+#include "PostList.h"
+#include "TextWidth.h"
+
+#define PARTIAL_POST_TITLE "..."
+#define CURRENT_POST_MARK '*'
+
+void PostList::setWindow(WINDOW* win){
+        window = win;
+}
+void PostList::setColors(chtype fore, chtype back, chtype grey){
+        foreColor = fore;
+        backColor = back;
+        greyColor = grey;
+}
+// Shows the posts of the store, in the order of the handles, all unread, with
+// the cursor on the first one. Both are read again on every draw and must
+// outlive the list, or be replaced; without handles the list is empty.
+void PostList::setPosts(const PostStore* newStore, const std::vector<PostHandle>* newHandles){
+        store = newStore;
+        handles = newHandles;
+        count = (handles != nullptr) ? handles->size() : 0;
+        cursor = 0;
+        top = 0;
+        read.assign(count, false);
+        readCount = 0;
+}
+// Takes in the posts added at the end of the handles, unread.
+void PostList::append(size_t added){
+        count += added;
+        read.resize(count, false);
+}
+// Takes in the posts after the handles were rearranged, given the index each
+// one had before; any index past the previous posts marks a new one. Posts
+// kept keep their read state, and the cursor stays on its post, or moves to
+// the first kept post after it, on the same row of the window unless that
+// would leave rows past the end empty.
+void PostList::replace(const std::vector<size_t>& previous){
+        auto newRead = std::vector<bool>(previous.size(), false);
+        auto newCursor = previous.size();
+        auto nearest = count;
+        readCount = 0;
+        for(size_t i = 0; i < previous.size(); i++){
+                if(previous[i] >= count){
+                        continue;
+                }
+
+                newRead[i] = read[previous[i]];
+                readCount += newRead[i] ? 1 : 0;
+                if((previous[i] >= cursor) && (previous[i] < nearest)){
+                        nearest = previous[i];
+                        newCursor = i;
+                }
+        }
+
+        const auto row = cursor - top;
+        count = previous.size();
+        read = std::move(newRead);
+        cursor = (newCursor < count) ? newCursor : ((count > 0) ? count - 1 : 0);
+        top = (cursor > row) ? cursor - row : 0;
+        if(top + rows() > count){
+                top = (count > rows()) ? count - rows() : 0;
+        }
+        draw();
+}
+size_t PostList::size() const{
+        return count;
+}
+bool PostList::empty() const{
+        return count == 0;
+}
+size_t PostList::current() const{
+        return cursor;
+}
+// Moves the cursor to the post at index, or to the last one past the end, and
+// scrolls just enough to keep it in view. Returns whether it moved.
+bool PostList::select(size_t index){
+        if(count == 0){
+                return false;
+        }
+
+        index = std::min(index, count - 1);
+        if(index == cursor){
+                return false;
+        }
+
+        const auto previous = cursor;
+        const auto previousTop = top;
+        cursor = index;
+        if(cursor < top){
+                top = cursor;
+        }
+        else if(cursor >= top + rows()){
+                top = cursor - rows() + 1;
+        }
+
+        if(top != previousTop){
+                draw();
+        }
+        else{
+                drawRow(previous);
+                drawRow(cursor);
+                wsyncup(window);
+        }
+
+        return true;
+}
+bool PostList::isRead(size_t index) const{
+        return read.at(index);
+}
+void PostList::setRead(size_t index, bool isRead){
+        if(read.at(index) == isRead){
+                return;
+        }
+
+        read[index] = isRead;
+        readCount = isRead ? (readCount + 1) : (readCount - 1);
+        drawRow(index);
+        wsyncup(window);
+}
+size_t PostList::unreadCount() const{
+        return count - readCount;
+}
+void PostList::draw(){
+        if(window == nullptr){
+                return;
+        }
+
+        werase(window);
+        for(auto index = top; (index < count) && (index < top + rows()); index++){
+                drawRow(index);
+        }
+
+        // The window is a subwindow of the panel; the panel must see the rows
+        // that changed.
+        wsyncup(window);
+}
+size_t PostList::rows() const{
+        return (window != nullptr) ? std::max(getmaxy(window), 1) : 1;
+}
+// Read posts are greyed out, the current one is highlighted and marked.
+void PostList::drawRow(size_t index){
+        if((window == nullptr) || (index < top) || (index >= top + rows()) || (index >= count)){
+                return;
+        }
+
+        const auto post = store->get(handles->at(index));
+        const auto title = post.partial ? std::string_view(PARTIAL_POST_TITLE) : post.title;
+        const auto width = static_cast<size_t>(getmaxx(window));
+        const auto row = static_cast<int>(index - top);
+        const auto color = (index == cursor) ? foreColor : (read[index] ? greyColor : backColor);
+
+        size_t titleWidth = 0;
+        const auto bytes = fittingBytes(title.data(), title.size(), width - 1, titleWidth);
+
+        wattron(window, color);
+        mvwaddch(window, row, 0, (index == cursor) ? CURRENT_POST_MARK : ' ');
+        waddnstr(window, title.data(), bytes);
+        whline(window, ' ' | color, width - 1 - titleWidth);
+        wattroff(window, color);
+}
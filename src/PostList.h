@@ -0,0 +1,43 @@
+#include <string>
+#include <vector>
+
+#include <curses.h>
+
+#ifndef _POST_LIST_H_
+#define _POST_LIST_H_
+
+#include "PostStore.h"
+
+// The posts menu. Unlike a libmenu menu it keeps no item per post: only the
+// rows in view are drawn, straight from the post store, and the read
+// state is one bit per post, so loading or scrolling through thousands of
+// posts costs the same as through a screenful.
+class PostList{
+        public:
+                void setWindow(WINDOW* win);
+                void setColors(chtype fore, chtype back, chtype grey);
+                void setPosts(const PostStore* store, const std::vector<PostHandle>* handles);
+                void append(size_t count);
+                void replace(const std::vector<size_t>& previous);
+                size_t size() const;
+                bool empty() const;
+                size_t current() const;
+                bool select(size_t index);
+                bool isRead(size_t index) const;
+                void setRead(size_t index, bool read);
+                size_t unreadCount() const;
+                void draw();
+        private:
+                WINDOW* window{};
+                chtype foreColor{}, backColor{}, greyColor{};
+                const PostStore* store{};
+                const std::vector<PostHandle>* handles{};
+                size_t count{}, cursor{}, top{};
+                std::vector<bool> read;
+                size_t readCount{};
+
+                size_t rows() const;
+                void drawRow(size_t index);
+};
+
+#endif
@@ -0,0 +1,292 @@
+#include <string.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "PostStore.h"
+
+using namespace std::literals::string_literals;
+
+// Bodies are compressed as they arrive, so speed matters more than ratio.
+#define POST_COMPRESSION_LEVEL Z_BEST_SPEED
+
+// Bytes glibc's malloc takes for a request, its chunk header included.
+static size_t mallocBytes(size_t size){
+        return std::max<size_t>(32, (size + 8 + 15) & ~static_cast<size_t>(15));
+}
+// Short strings fit in the string object itself.
+static size_t stringHeapBytes(size_t length){
+        return (length < 16) ? 0 : mallocBytes(length + 1);
+}
+// Bucket array plus one node per element, with its cached hash.
+template<typename Map>
+static size_t hashTableBytes(const Map& map){
+        return map.bucket_count() * sizeof(void*) + map.size() * (sizeof(void*) + sizeof(typename Map::value_type) + sizeof(size_t));
+}
+
+// An entry added again keeps its handle; a partial post is completed.
+PostHandle PostStore::add(const PostData& post){
+        if(const auto known = find(post.id)){
+                if(posts[*known].partial && !post.partial){
+                        replace(*known, post);
+                }
+                return *known;
+        }
+
+        return insert(makePost(post));
+}
+// Adds a post whose body was packed already, ignoring its content; the body
+// is copied as it is.
+PostHandle PostStore::add(const PostData& post, const PackedText& content){
+        if(const auto known = find(post.id)){
+                if(posts[*known].partial && !post.partial){
+                        replacedTextBytes += textLength(posts[*known]);
+                        posts[*known] = makePost(post, content.bytes, content.length, content.compressed);
+                }
+                return *known;
+        }
+
+        return insert(makePost(post, content.bytes, content.length, content.compressed));
+}
+// Completes a partial post; the id stays the same.
+void PostStore::replace(PostHandle handle, const PostData& post){
+        replacedTextBytes += textLength(posts.at(handle));
+        posts[handle] = makePost(post);
+}
+const PostHandle* PostStore::find(std::string_view id) const{
+        const auto it = handles.find(id);
+        return (it != handles.end()) ? &it->second : nullptr;
+}
+PostView PostStore::get(PostHandle handle) const{
+        const auto& post = posts.at(handle);
+        auto view = PostView{};
+        auto text = post.text + post.packedContentLength;
+        view.title = std::string_view(text, post.titleLength);
+        text += post.titleLength;
+        view.id = std::string_view(text, post.idLength);
+        text += post.idLength;
+        view.originURL = std::string_view(text, post.originURLLength);
+        view.originTitle = interned[post.originTitle];
+        view.published = post.published;
+        view.crawled = post.crawled;
+        view.partial = post.partial;
+        return view;
+}
+std::vector<std::string_view> PostStore::categories(PostHandle handle) const{
+        const auto& post = posts.at(handle);
+        auto result = std::vector<std::string_view>{};
+        result.reserve(post.categoryCount);
+        for(uint32_t i = post.firstCategory; i < post.firstCategory + post.categoryCount; i++){
+                result.push_back(interned[categoryIndices[i]]);
+        }
+        return result;
+}
+std::string PostStore::content(PostHandle handle) const{
+        const auto& post = posts.at(handle);
+        return unpack(std::string_view(post.text, post.packedContentLength), post.contentLength, post.contentCompressed);
+}
+// A copy of the body as it is stored, to be unpacked later, possibly on
+// another thread.
+PackedText PostStore::packedContent(PostHandle handle) const{
+        const auto& post = posts.at(handle);
+        return PackedText{std::string(post.text, post.packedContentLength), post.contentLength, post.contentCompressed};
+}
+std::string PostStore::unpack(const PackedText& text) const{
+        return unpack(text.bytes, text.length, text.compressed);
+}
+size_t PostStore::size() const{
+        return posts.size();
+}
+// Bytes of the arena, and those of it left behind by replace.
+size_t PostStore::textBytes() const{
+        return arenaBytes;
+}
+size_t PostStore::replacedBytes() const{
+        return replacedTextBytes;
+}
+// Moves the posts keep holds true for to new blocks, along with the strings
+// they share, and drops the others and whatever text was replaced. Bodies
+// are copied as they are, without compressing them again. Returns the new
+// handle of every post, INVALID_POST_HANDLE for those dropped.
+std::vector<PostHandle> PostStore::compact(const std::vector<bool>& keep){
+        auto moved = std::vector<PostHandle>(posts.size(), INVALID_POST_HANDLE);
+        auto oldPosts = std::move(posts);
+        auto oldInterned = std::move(interned);
+        auto oldCategoryIndices = std::move(categoryIndices);
+        const auto oldBlocks = std::move(blocks);
+
+        posts.clear();
+        posts.reserve(std::count(keep.begin(), keep.end(), true));
+        handles = decltype(handles){};
+        interned.clear();
+        internIndex = decltype(internIndex){};
+        categoryIndices.clear();
+        blocks.clear();
+        blockCursor = nullptr;
+        blockLeft = 0;
+        arenaBytes = 0;
+        replacedTextBytes = 0;
+        compactions++;
+
+        for(PostHandle handle = 0; handle < oldPosts.size(); handle++){
+                if(!keep.at(handle)){
+                        continue;
+                }
+
+                auto post = oldPosts[handle];
+                const auto length = textLength(post);
+                const auto text = allocate(length);
+                memcpy(text, post.text, length);
+                post.text = text;
+                post.originTitle = intern(oldInterned[post.originTitle]);
+
+                const auto firstCategory = static_cast<uint32_t>(categoryIndices.size());
+                for(uint32_t i = post.firstCategory; i < post.firstCategory + post.categoryCount; i++){
+                        categoryIndices.push_back(intern(oldInterned[oldCategoryIndices[i]]));
+                }
+                post.firstCategory = firstCategory;
+
+                moved[handle] = static_cast<PostHandle>(posts.size());
+                posts.push_back(post);
+                handles.emplace(get(moved[handle]).id, moved[handle]);
+        }
+
+        return moved;
+}
+PostStoreStats PostStore::getStats() const{
+        auto stats = PostStoreStats{};
+        stats.posts = handles.size();
+        stats.internedStrings = interned.size();
+        stats.compactions = compactions;
+        stats.bytes = posts.capacity() * sizeof(Post) + arenaBytes + scratch.capacity() +
+            interned.capacity() * sizeof(std::string_view) + categoryIndices.capacity() * sizeof(uint32_t) +
+            hashTableBytes(handles) + hashTableBytes(internIndex);
+
+        for(const auto& [id, handle] : handles){
+                const auto view = get(handle);
+                const auto& post = posts[handle];
+                stats.contentBytes += post.contentLength;
+                stats.packedContentBytes += post.packedContentLength;
+                stats.postDataBytes += sizeof(PostData) + stringHeapBytes(post.contentLength) +
+                    stringHeapBytes(view.title.size()) + stringHeapBytes(view.id.size()) +
+                    stringHeapBytes(view.originURL.size()) + stringHeapBytes(view.originTitle.size());
+                if(post.categoryCount > 0){
+                        stats.postDataBytes += mallocBytes(post.categoryCount * sizeof(std::string));
+                }
+                for(const auto category : categories(handle)){
+                        stats.postDataBytes += stringHeapBytes(category.size());
+                }
+        }
+
+        auto lock = std::lock_guard(unpackMutex);
+        stats.unpacked = unpacked;
+        stats.unpackTime = unpackTime;
+        stats.maxUnpackTime = maxUnpackTime;
+
+        return stats;
+}
+PostHandle PostStore::insert(const Post& post){
+        const auto handle = static_cast<PostHandle>(posts.size());
+        posts.push_back(post);
+        handles.emplace(get(handle).id, handle);
+        return handle;
+}
+PostStore::Post PostStore::makePost(const PostData& post){
+        auto content = std::string_view(post.content);
+        auto compressed = false;
+        if(!content.empty()){
+                scratch.resize(compressBound(content.size()));
+                auto packedLength = static_cast<uLongf>(scratch.size());
+                const auto result = compress2(scratch.data(), &packedLength, reinterpret_cast<const Bytef*>(content.data()),
+                    content.size(), POST_COMPRESSION_LEVEL);
+                if((result == Z_OK) && (packedLength < content.size())){
+                        content = std::string_view(reinterpret_cast<const char*>(scratch.data()), packedLength);
+                        compressed = true;
+                }
+        }
+
+        return makePost(post, content, post.content.size(), compressed);
+}
+PostStore::Post PostStore::makePost(const PostData& post, std::string_view content, size_t contentLength, bool compressed){
+        const auto length = content.size() + post.title.size() + post.id.size() + post.originURL.size();
+        auto text = allocate(length);
+        auto result = Post{text,
+                static_cast<uint32_t>(content.size()), static_cast<uint32_t>(post.title.size()),
+                static_cast<uint32_t>(post.id.size()), static_cast<uint32_t>(post.originURL.size()),
+                static_cast<uint32_t>(contentLength), intern(post.originTitle),
+                static_cast<uint32_t>(categoryIndices.size()), static_cast<uint16_t>(post.categories.size()),
+                compressed, post.partial, post.published, post.crawled};
+
+        for(const auto s : {content, std::string_view(post.title), std::string_view(post.id), std::string_view(post.originURL)}){
+                memcpy(text, s.data(), s.size());
+                text += s.size();
+        }
+        for(const auto& category : post.categories){
+                categoryIndices.push_back(intern(category));
+        }
+
+        return result;
+}
+size_t PostStore::textLength(const Post& post){
+        return post.packedContentLength + post.titleLength + post.idLength + post.originURLLength;
+}
+std::string PostStore::unpack(std::string_view bytes, size_t length, bool compressed) const{
+        if(!compressed){
+                return std::string(bytes);
+        }
+
+        const auto started = std::chrono::steady_clock::now();
+        auto text = std::string(length, '\0');
+        auto unpackedLength = static_cast<uLongf>(length);
+        const auto result = uncompress(reinterpret_cast<Bytef*>(text.data()), &unpackedLength,
+            reinterpret_cast<const Bytef*>(bytes.data()), bytes.size());
+        if((result != Z_OK) || (unpackedLength != length)){
+                throw std::runtime_error("Could not unpack the post: "s + zError(result));
+        }
+        const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started);
+
+        auto lock = std::lock_guard(unpackMutex);
+        unpacked++;
+        unpackTime += elapsed;
+        maxUnpackTime = std::max(maxUnpackTime, elapsed);
+
+        return text;
+}
+// Text is carved out of the current block. Blocks double in size up to
+// POST_ARENA_BLOCK_SIZE, so a short stream does not take a large one, and a
+// string too large for one gets a block of its own so the current one is not
+// left mostly unused.
+char* PostStore::allocate(size_t size){
+        if(size > POST_ARENA_BLOCK_SIZE / 4){
+                blocks.emplace_back(new char[size]);
+                arenaBytes += size;
+                return blocks.back().get();
+        }
+
+        if((blockCursor == nullptr) || (size > blockLeft)){
+                const auto blockSize = std::max(size, std::clamp<size_t>(arenaBytes, POST_ARENA_MIN_BLOCK_SIZE, POST_ARENA_BLOCK_SIZE));
+                blocks.emplace_back(new char[blockSize]);
+                arenaBytes += blockSize;
+                blockCursor = blocks.back().get();
+                blockLeft = blockSize;
+        }
+
+        const auto result = blockCursor;
+        blockCursor += size;
+        blockLeft -= size;
+        return result;
+}
+uint32_t PostStore::intern(std::string_view s){
+        if(const auto it = internIndex.find(s); it != internIndex.end()){
+                return it->second;
+        }
+
+        const auto text = allocate(s.size());
+        memcpy(text, s.data(), s.size());
+
+        const auto index = static_cast<uint32_t>(interned.size());
+        interned.emplace_back(text, s.size());
+        internIndex.emplace(interned.back(), index);
+        return index;
+}
@@ -0,0 +1,126 @@
+#include <stdint.h>
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#ifndef _POST_STORE_H_
+#define _POST_STORE_H_
+
+#include "PostData.h"
+
+#define POST_ARENA_MIN_BLOCK_SIZE (4 * 1024)
+#define POST_ARENA_BLOCK_SIZE (64 * 1024)
+
+using PostHandle = uint32_t;
+
+#define INVALID_POST_HANDLE static_cast<PostHandle>(-1)
+
+// A post of a PostStore, without its body. The strings point into the store
+// and stay valid as long as it lives.
+struct PostView{
+        std::string_view title;
+        std::string_view id;
+        std::string_view originURL;
+        std::string_view originTitle;
+        long long published{};
+        long long crawled{};
+        bool partial{};
+};
+
+// A post body as the store keeps it: zlib-compressed, unless that saved
+// nothing, with the length it has once unpacked.
+struct PackedText{
+        std::string bytes;
+        size_t length{};
+        bool compressed{};
+};
+
+// Memory held by the store, against an estimate of what the same posts take
+// as PostData, each string of its own on the heap; the bodies in it, packed
+// and not; and the bodies unpacked for the whole session.
+struct PostStoreStats{
+        size_t posts{};
+        size_t internedStrings{};
+        size_t bytes{};
+        size_t postDataBytes{};
+        size_t contentBytes{};
+        size_t packedContentBytes{};
+        unsigned long compactions{};
+        unsigned long unpacked{};
+        std::chrono::microseconds unpackTime{};
+        std::chrono::microseconds maxUnpackTime{};
+};
+
+// The posts loaded for any stream, each entry once. Their text is copied
+// back to back into an arena of large blocks instead of five strings per
+// post, the origin titles and categories shared by many posts are kept once,
+// and posts are found by id through a hash map. A post is addressed by a
+// handle, valid until the store is compacted; completing a partial post
+// leaves its old text in the arena until then.
+//
+// Bodies, by far the largest part of a post, are compressed and only
+// unpacked to be rendered. unpack touches nothing but its statistics, under
+// a lock, so packed bodies can be handed to other threads.
+class PostStore{
+        public:
+                PostHandle add(const PostData& post);
+                PostHandle add(const PostData& post, const PackedText& content);
+                void replace(PostHandle handle, const PostData& post);
+                const PostHandle* find(std::string_view id) const;
+                PostView get(PostHandle handle) const;
+                std::vector<std::string_view> categories(PostHandle handle) const;
+                std::string content(PostHandle handle) const;
+                PackedText packedContent(PostHandle handle) const;
+                std::string unpack(const PackedText& text) const;
+                size_t size() const;
+                size_t textBytes() const;
+                size_t replacedBytes() const;
+                std::vector<PostHandle> compact(const std::vector<bool>& keep);
+                PostStoreStats getStats() const;
+        private:
+                // The packed content, title, id and origin URL follow each
+                // other at text.
+                struct Post{
+                        const char* text;
+                        uint32_t packedContentLength, titleLength, idLength, originURLLength;
+                        uint32_t contentLength;
+                        uint32_t originTitle;
+                        uint32_t firstCategory;
+                        uint16_t categoryCount;
+                        bool contentCompressed;
+                        bool partial;
+                        long long published;
+                        long long crawled;
+                };
+
+                std::vector<Post> posts;
+                std::unordered_map<std::string_view, PostHandle> handles;
+                std::vector<std::string_view> interned;
+                std::unordered_map<std::string_view, uint32_t> internIndex;
+                std::vector<uint32_t> categoryIndices;
+                std::vector<std::unique_ptr<char[]>> blocks;
+                char* blockCursor{};
+                size_t blockLeft{};
+                size_t arenaBytes{};
+                size_t replacedTextBytes{};
+                unsigned long compactions{};
+                std::vector<unsigned char> scratch;
+                mutable std::mutex unpackMutex;
+                mutable unsigned long unpacked{};
+                mutable std::chrono::microseconds unpackTime{}, maxUnpackTime{};
+
+                PostHandle insert(const Post& post);
+                Post makePost(const PostData& post);
+                Post makePost(const PostData& post, std::string_view content, size_t contentLength, bool compressed);
+                static size_t textLength(const Post& post);
+                std::string unpack(std::string_view bytes, size_t length, bool compressed) const;
+                char* allocate(size_t size);
+                uint32_t intern(std::string_view s);
+};
+
+#endif
@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <clocale>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "BenchResponse.h"
+#include "HtmlRenderer.h"
+#include "StreamParser.h"
+
+using namespace std::literals::string_literals;
+
+#define BENCH_DEFAULT_ENTRIES 500
+#define BENCH_DEFAULT_COLUMNS 80
+
+// Compares rendering previews with HtmlRenderer against piping them through
+// w3m, the way renderPreview did before: the body written to a file, then
+// "w3m -dump -cols <columns> <file>" read back through popen. The bodies come
+// from a streams/contents response, a file or a generated one. Another
+// command can stand in for w3m with -w; it is given the file as its last
+// argument, so "-w cat" measures what the pipe costs besides w3m itself.
+//
+//      preview-bench [response.json | -n entries] [-c columns] [-w command]
+
+struct RenderTimes{
+        size_t count{};
+        size_t bytes{};
+        std::chrono::microseconds total{};
+        std::chrono::microseconds max{};
+};
+
+static std::vector<std::string> readBodies(const std::string& body){
+        auto bodies = std::vector<std::string>{};
+        auto parser = StreamParser([&bodies](PostData&& post){
+                bodies.push_back(std::move(post.content));
+        });
+        parser.feed(body.data(), body.size());
+        parser.finish();
+
+        return bodies;
+}
+template<typename Render>
+static RenderTimes measure(const std::vector<std::string>& bodies, Render render){
+        auto times = RenderTimes{};
+        for(const auto& html : bodies){
+                const auto started = std::chrono::steady_clock::now();
+                times.bytes += render(html).size();
+                const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started);
+                times.count++;
+                times.total += elapsed;
+                times.max = std::max(times.max, elapsed);
+        }
+
+        return times;
+}
+static void report(const char* name, const RenderTimes& times){
+        std::cout << name << ": " << times.count << " previews, " << times.bytes / 1024 << " kB of text, "
+                << times.total.count() / 1000 << " ms in all, "
+                << times.total.count() / std::max<size_t>(times.count, 1) << " us average, "
+                << times.max.count() << " us max" << std::endl;
+}
+static std::string renderThroughPipe(const std::string& html, const std::string& command, const std::string& path){
+        if(auto file = std::ofstream(path)){
+                file << html;
+        }
+
+        auto content = std::string{};
+        const auto stream = popen((command + " " + path).c_str(), "r");
+        if(stream == NULL){
+                throw std::runtime_error("Could not run " + command);
+        }
+
+        char buffer[256];
+        while(fgets(buffer, sizeof(buffer), stream) != NULL){
+                content.append(buffer);
+        }
+        if(pclose(stream) != 0){
+                throw std::runtime_error(command + " failed");
+        }
+
+        return content;
+}
+
+int main(int argc, char** argv){
+        // Text is measured in the columns it takes, as in the preview window.
+        setlocale(LC_ALL, "");
+
+        auto entries = static_cast<size_t>(BENCH_DEFAULT_ENTRIES);
+        auto columns = static_cast<size_t>(BENCH_DEFAULT_COLUMNS);
+        auto command = std::string{};
+        const char* responsePath = NULL;
+        for(int i = 1; i < argc; i++){
+                const auto option = std::string(argv[i]);
+                if((option == "-n") && (i + 1 < argc)){
+                        entries = std::stoul(argv[++i]);
+                }
+                else if((option == "-c") && (i + 1 < argc)){
+                        columns = std::stoul(argv[++i]);
+                }
+                else if((option == "-w") && (i + 1 < argc)){
+                        command = argv[++i];
+                }
+                else if((option[0] != '-') && (responsePath == NULL)){
+                        responsePath = argv[i];
+                }
+                else{
+                        std::cerr << "Usage: " << argv[0] << " [response.json | -n entries] [-c columns] [-w command]" << std::endl;
+                        return 2;
+                }
+        }
+        if(command.empty()){
+                command = "w3m -dump -cols " + std::to_string(columns);
+        }
+
+        auto path = std::string{};
+        try{
+                const auto bodies = readBodies((responsePath != NULL) ? readResponse(responsePath) : generateStream(entries));
+                std::cout << "Bodies: " << bodies.size() << ", wrapped at " << columns << " columns" << std::endl;
+
+                report("HtmlRenderer", measure(bodies, [columns](const std::string& html){
+                        return HtmlRenderer(columns).render(html);
+                }));
+
+                auto pathTemplate = std::string(getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp") + "/preview-bench.XXXXXX";
+                const auto fd = mkstemp(pathTemplate.data());
+                if(fd < 0){
+                        throw std::runtime_error("Could not create a temporary file");
+                }
+                close(fd);
+                path = pathTemplate;
+
+                report(command.c_str(), measure(bodies, [&command, &path](const std::string& html){
+                        return renderThroughPipe(html, command, path);
+                }));
+        }
+        catch(const std::exception& e){
+                std::cerr << e.what() << std::endl;
+                if(!path.empty()){
+                        unlink(path.c_str());
+                }
+                return 1;
+        }
+
+        unlink(path.c_str());
+        return 0;
+}
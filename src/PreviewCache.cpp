@@ -0,0 +1,76 @@
+#include "PreviewCache.h"
+
+// Bookkeeping of an entry besides its text: the list node, the index node
+// and the two copies of the id.
+#define ENTRY_OVERHEAD 128
+
+PreviewCache::PreviewCache(size_t byteBudget):
+        budget{byteBudget}{
+}
+void PreviewCache::setBudget(size_t byteBudget){
+        const auto lock = std::lock_guard<std::mutex>(mutex);
+        budget = byteBudget;
+        evict(0);
+}
+std::shared_ptr<const std::string> PreviewCache::find(const std::string& id, size_t width){
+        const auto lock = std::lock_guard<std::mutex>(mutex);
+        const auto it = index.find(Key{id, width});
+        if(it == index.end()){
+                stats.misses++;
+                return nullptr;
+        }
+
+        stats.hits++;
+        entries.splice(entries.begin(), entries, it->second);
+        return it->second->text;
+}
+// Unlike find, does not count as a use of the entry.
+bool PreviewCache::contains(const std::string& id, size_t width) const{
+        const auto lock = std::lock_guard<std::mutex>(mutex);
+        return index.count(Key{id, width}) > 0;
+}
+// Returns false if the text was not stored, because it is larger than the
+// budget or, without evictOthers, because it only fits by evicting others.
+bool PreviewCache::insert(const std::string& id, size_t width, std::shared_ptr<const std::string> text, bool evictOthers){
+        const auto bytes = text->size() + 2 * id.size() + ENTRY_OVERHEAD;
+
+        const auto lock = std::lock_guard<std::mutex>(mutex);
+        auto key = Key{id, width};
+        if(const auto it = index.find(key); it != index.end()){
+                stats.bytes -= it->second->bytes;
+                entries.erase(it->second);
+                index.erase(it);
+        }
+        if((bytes > budget) || (!evictOthers && (stats.bytes + bytes > budget))){
+                return false;
+        }
+
+        evict(bytes);
+        entries.push_front(Entry{key, std::move(text), bytes});
+        index.emplace(std::move(key), entries.begin());
+        stats.bytes += bytes;
+        return true;
+}
+// Drop everything, e.g. when the terminal is resized.
+void PreviewCache::clear(){
+        const auto lock = std::lock_guard<std::mutex>(mutex);
+        entries.clear();
+        index.clear();
+        stats.bytes = 0;
+}
+PreviewCacheStats PreviewCache::getStats() const{
+        const auto lock = std::lock_guard<std::mutex>(mutex);
+        auto result = stats;
+        result.entries = entries.size();
+        return result;
+}
+// Evict the least recently used entries until `needed` more bytes fit.
+void PreviewCache::evict(size_t needed){
+        while(!entries.empty() && stats.bytes + needed > budget){
+                const auto& oldest = entries.back();
+                stats.bytes -= oldest.bytes;
+                stats.evictions++;
+                index.erase(oldest.key);
+                entries.pop_back();
+        }
+}
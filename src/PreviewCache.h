@@ -0,0 +1,49 @@
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#ifndef _PREVIEW_CACHE_H_
+#define _PREVIEW_CACHE_H_
+
+struct PreviewCacheStats{
+        unsigned long hits{};
+        unsigned long misses{};
+        unsigned long evictions{};
+        size_t bytes{};
+        size_t entries{};
+};
+
+// Least recently used cache of rendered previews, keyed by entry id and the
+// width they were wrapped at. Its size is bounded by a byte budget; the text
+// is shared, so evicting an entry never invalidates a preview being drawn.
+// It is safe to use from several threads.
+class PreviewCache{
+        public:
+                explicit PreviewCache(size_t byteBudget = 0);
+                void setBudget(size_t byteBudget);
+                std::shared_ptr<const std::string> find(const std::string& id, size_t width);
+                bool contains(const std::string& id, size_t width) const;
+                bool insert(const std::string& id, size_t width, std::shared_ptr<const std::string> text, bool evictOthers = true);
+                void clear();
+                PreviewCacheStats getStats() const;
+        private:
+                using Key = std::pair<std::string, size_t>;
+                struct Entry{
+                        Key key;
+                        std::shared_ptr<const std::string> text;
+                        size_t bytes;
+                };
+
+                mutable std::mutex mutex;
+                size_t budget;
+                std::list<Entry> entries;
+                std::map<Key, std::list<Entry>::iterator> index;
+                PreviewCacheStats stats;
+
+                void evict(size_t needed);
+};
+
+#endif
@@ -0,0 +1,125 @@
+#include <json/json.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "BenchResponse.h"
+#include "StreamParser.h"
+
+using namespace std::literals::string_literals;
+
+// Bytes curl hands the write callback at most, as the parser gets them.
+#define BENCH_CHUNK_SIZE (16 * 1024)
+#define BENCH_DEFAULT_ENTRIES 10000
+#define BENCH_RUNS 5
+
+// Compares StreamParser against parsing the same streams/contents response
+// into a Json::Value tree with jsoncpp and copying the entries out of it, the
+// way giveStreamPosts did before. The response is either a file, as written
+// by debug_dump_responses or saved from the API, or a generated stream of
+// entries with about 2 kB of HTML each.
+//
+//      stream-bench [response.json | -n entries]
+
+static std::vector<PostData> parseWithJsoncpp(const std::string& body){
+        Json::Reader reader;
+        Json::Value root;
+        if(!reader.parse(body.data(), body.data() + body.size(), root)){
+                throw std::runtime_error("Failed to parse response: "s + reader.getFormattedErrorMessages());
+        }
+
+        auto posts = std::vector<PostData>{};
+        for(const auto& item : root["items"]){
+                auto post = PostData{};
+                post.content = item["summary"]["content"].asString();
+                post.title = item["title"].asString();
+                post.id = item["id"].asString();
+                for(const auto& alternate : item["alternate"]){
+                        if(alternate["type"].asString() == "text/html"){
+                                post.originURL = alternate["href"].asString();
+                                break;
+                        }
+                }
+                post.originTitle = item["origin"]["title"].asString();
+                post.published = item["published"].asInt64();
+                post.crawled = item["crawled"].asInt64();
+                for(const auto& category : item["categories"]){
+                        post.categories.push_back(category["id"].asString());
+                }
+                posts.push_back(std::move(post));
+        }
+
+        return posts;
+}
+static std::vector<PostData> parseWithStreamParser(const std::string& body){
+        auto posts = std::vector<PostData>{};
+        auto parser = StreamParser([&posts](PostData&& post){
+                posts.push_back(std::move(post));
+        });
+        for(size_t offset = 0; offset < body.size(); offset += BENCH_CHUNK_SIZE){
+                parser.feed(body.data() + offset, std::min<size_t>(BENCH_CHUNK_SIZE, body.size() - offset));
+        }
+        parser.finish();
+
+        return posts;
+}
+static bool samePosts(const std::vector<PostData>& first, const std::vector<PostData>& second){
+        return std::equal(first.begin(), first.end(), second.begin(), second.end(), [](const PostData& a, const PostData& b){
+                return (a.content == b.content) && (a.title == b.title) && (a.id == b.id) && (a.originURL == b.originURL) &&
+                    (a.originTitle == b.originTitle) && (a.published == b.published) && (a.crawled == b.crawled) &&
+                    (a.categories == b.categories);
+        });
+}
+// Best and median of BENCH_RUNS parses, in milliseconds.
+template<typename Parse>
+static std::vector<PostData> measure(const char* name, const std::string& body, Parse parse){
+        auto posts = std::vector<PostData>{};
+        auto times = std::vector<double>{};
+        for(int run = 0; run < BENCH_RUNS; run++){
+                const auto started = std::chrono::steady_clock::now();
+                posts = parse(body);
+                times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count());
+        }
+
+        std::sort(times.begin(), times.end());
+        std::cout << name << ": " << posts.size() << " posts, best " << times.front() << " ms, median "
+                << times[times.size() / 2] << " ms" << std::endl;
+        return posts;
+}
+
+int main(int argc, char** argv){
+        try{
+                auto body = std::string{};
+                if((argc == 3) && (argv[1] == "-n"s)){
+                        body = generateStream(std::stoul(argv[2]));
+                }
+                else if(argc == 2){
+                        body = readResponse(argv[1]);
+                }
+                else if(argc == 1){
+                        body = generateStream(BENCH_DEFAULT_ENTRIES);
+                }
+                else{
+                        std::cerr << "Usage: " << argv[0] << " [response.json | -n entries]" << std::endl;
+                        return 2;
+                }
+
+                std::cout << "Response: " << body.size() / 1024 << " kB" << std::endl;
+                const auto tree = measure("jsoncpp", body, parseWithJsoncpp);
+                const auto streamed = measure("StreamParser", body, parseWithStreamParser);
+                if(!samePosts(tree, streamed)){
+                        std::cerr << "The parsers disagree on the posts" << std::endl;
+                        return 1;
+                }
+        }
+        catch(const std::exception& e){
+                std::cerr << e.what() << std::endl;
+                return 1;
+        }
+
+        return 0;
+}
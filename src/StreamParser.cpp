@@ -0,0 +1,347 @@
+#include <ctype.h>
+#include <stdexcept>
+#include <string.h>
+
+#include "StreamParser.h"
+
+using namespace std::literals::string_literals;
+
+StreamParser::StreamParser(PostCallback callback):
+        onPost{std::move(callback)}{
+}
+void StreamParser::feed(const char* data, size_t size){
+        size_t i = 0;
+        while(i < size){
+                const char c = data[i];
+                switch(lexer){
+                        case Lexer::Value:
+                                if(isspace(static_cast<unsigned char>(c))){
+                                        break;
+                                }
+                                if(!frames.empty() && frames.back().isObject && frames.back().expectingKey && (c != '"') && (c != '}') && (c != ',')){
+                                        throw std::runtime_error("Failed to parse stream: expected a key, found '"s + c + "'");
+                                }
+
+                                switch(c){
+                                        case '{':
+                                                beginContainer(true);
+                                                break;
+                                        case '[':
+                                                beginContainer(false);
+                                                break;
+                                        case '}':
+                                                endContainer(true);
+                                                break;
+                                        case ']':
+                                                endContainer(false);
+                                                break;
+                                        case '"':
+                                                beginString();
+                                                break;
+                                        case ',':
+                                                if(!frames.empty() && frames.back().isObject){
+                                                        frames.back().expectingKey = true;
+                                                }
+                                                break;
+                                        case ':':
+                                                break;
+                                        default:
+                                                token.assign(1, c);
+                                                lexer = Lexer::Literal;
+                                                break;
+                                }
+                                break;
+                        case Lexer::String:
+                                {
+                                        // Copy a whole run of plain characters at once.
+                                        size_t end = i;
+                                        while((end < size) && (data[end] != '"') && (data[end] != '\\')){
+                                                end++;
+                                        }
+                                        if(capturing && (end > i)){
+                                                flushSurrogate();
+                                                token.append(data + i, end - i);
+                                        }
+                                        if(end == size){
+                                                return;
+                                        }
+
+                                        i = end;
+                                        if(data[i] == '"'){
+                                                endString();
+                                        }
+                                        else{
+                                                lexer = Lexer::Escape;
+                                        }
+                                }
+                                break;
+                        case Lexer::Escape:
+                                lexer = Lexer::String;
+                                if(c == 'u'){
+                                        unicodeDigits = 0;
+                                        unicodeValue = 0;
+                                        lexer = Lexer::Unicode;
+                                        break;
+                                }
+                                if(capturing){
+                                        flushSurrogate();
+                                }
+                                switch(c){
+                                        case '"':  if(capturing) token.push_back('"');  break;
+                                        case '\\': if(capturing) token.push_back('\\'); break;
+                                        case '/':  if(capturing) token.push_back('/');  break;
+                                        case 'b':  if(capturing) token.push_back('\b'); break;
+                                        case 'f':  if(capturing) token.push_back('\f'); break;
+                                        case 'n':  if(capturing) token.push_back('\n'); break;
+                                        case 'r':  if(capturing) token.push_back('\r'); break;
+                                        case 't':  if(capturing) token.push_back('\t'); break;
+                                        default:
+                                                throw std::runtime_error("Failed to parse stream: invalid escape '\\"s + c + "'");
+                                }
+                                break;
+                        case Lexer::Unicode:
+                                if(!isxdigit(static_cast<unsigned char>(c))){
+                                        throw std::runtime_error("Failed to parse stream: invalid unicode escape");
+                                }
+                                unicodeValue = (unicodeValue << 4) | (isdigit(static_cast<unsigned char>(c)) ? (c - '0') : ((tolower(c) - 'a') + 10));
+                                if(++unicodeDigits == 4){
+                                        lexer = Lexer::String;
+                                        if(capturing){
+                                                appendCodePoint(unicodeValue);
+                                        }
+                                }
+                                break;
+                        case Lexer::Literal:
+                                if(isalnum(static_cast<unsigned char>(c)) || (c == '-') || (c == '+') || (c == '.')){
+                                        token.push_back(c);
+                                        break;
+                                }
+
+                                // The delimiter belongs to the enclosing value, look at it again.
+                                endLiteral();
+                                continue;
+                }
+                i++;
+        }
+}
+void StreamParser::finish(){
+        if(lexer == Lexer::Literal){
+                endLiteral();
+        }
+        if(!done || (lexer != Lexer::Value)){
+                throw std::runtime_error("Failed to parse stream: unexpected end of response");
+        }
+        if(!errorMessage.empty() && !errorId.empty()){
+                throw std::runtime_error("Feedly returned an error: "s + errorMessage + " ("s + errorId + ")"s);
+        }
+}
+const std::string& StreamParser::getContinuation() const{
+        return continuation;
+}
+size_t StreamParser::getPostCount() const{
+        return postCount;
+}
+void StreamParser::beginContainer(bool isObject){
+        if(done){
+                throw std::runtime_error("Failed to parse stream: trailing data after the response");
+        }
+
+        frames.push_back({isObject, isObject, std::string{}});
+
+        const auto depth = frames.size();
+        if(depth == 3 && inItem(depth)){
+                post = PostData{};
+        }
+        else if(depth == 5 && inItem(depth) && (frames[2].key == "alternate") && !frames[3].isObject && isObject){
+                alternateHref.clear();
+                alternateType.clear();
+        }
+        else if(depth == 5 && inItem(depth) && (frames[2].key == "categories") && !frames[3].isObject && isObject){
+                categoryId.clear();
+        }
+}
+void StreamParser::endContainer(bool isObject){
+        if(frames.empty() || (frames.back().isObject != isObject)){
+                throw std::runtime_error("Failed to parse stream: unbalanced brackets");
+        }
+
+        const auto depth = frames.size();
+        if(depth == 3 && inItem(depth)){
+                postCount++;
+                onPost(std::move(post));
+                post = PostData{};
+        }
+        else if(depth == 5 && inItem(depth) && (frames[2].key == "alternate") && !frames[3].isObject && isObject){
+                if((alternateType == "text/html") && post.originURL.empty()){
+                        post.originURL = alternateHref;
+                }
+        }
+        else if(depth == 5 && inItem(depth) && (frames[2].key == "categories") && !frames[3].isObject && isObject){
+                if(!categoryId.empty()){
+                        post.categories.push_back(std::move(categoryId));
+                }
+        }
+
+        frames.pop_back();
+        if(frames.empty()){
+                done = true;
+        }
+}
+void StreamParser::beginString(){
+        if(done){
+                throw std::runtime_error("Failed to parse stream: trailing data after the response");
+        }
+
+        token.clear();
+        highSurrogate = 0;
+        readingKey = !frames.empty() && frames.back().isObject && frames.back().expectingKey;
+        capturing = readingKey || (valueTarget() != NULL);
+        lexer = Lexer::String;
+}
+void StreamParser::endString(){
+        if(capturing){
+                flushSurrogate();
+        }
+
+        if(readingKey){
+                frames.back().key.swap(token);
+                frames.back().expectingKey = false;
+        }
+        else if(auto target = valueTarget()){
+                target->swap(token);
+        }
+
+        if(frames.empty()){
+                done = true;
+        }
+        lexer = Lexer::Value;
+}
+void StreamParser::endLiteral(){
+        lexer = Lexer::Value;
+        if(token != "true" && token != "false" && token != "null"){
+                char* end = NULL;
+                const auto value = strtod(token.c_str(), &end);
+                if(token.empty() || (*end != '\0')){
+                        throw std::runtime_error("Failed to parse stream: invalid literal '" + token + "'");
+                }
+                if(auto target = numberTarget()){
+                        *target = static_cast<long long>(value);
+                }
+        }
+        if(frames.empty()){
+                done = true;
+        }
+}
+// A high surrogate that is not followed by a low one is replaced by U+FFFD.
+void StreamParser::flushSurrogate(){
+        if(highSurrogate != 0){
+                highSurrogate = 0;
+                appendCodePoint(0xFFFD);
+        }
+}
+void StreamParser::appendCodePoint(unsigned int codePoint){
+        if(codePoint >= 0xD800 && codePoint <= 0xDBFF){
+                flushSurrogate();
+                highSurrogate = codePoint;
+                return;
+        }
+        if(codePoint >= 0xDC00 && codePoint <= 0xDFFF){
+                if(highSurrogate == 0){
+                        codePoint = 0xFFFD;
+                }
+                else{
+                        codePoint = 0x10000 + ((highSurrogate - 0xD800) << 10) + (codePoint - 0xDC00);
+                        highSurrogate = 0;
+                }
+        }
+        else{
+                flushSurrogate();
+        }
+
+        if(codePoint < 0x80){
+                token.push_back(static_cast<char>(codePoint));
+        }
+        else if(codePoint < 0x800){
+                token.push_back(static_cast<char>(0xC0 | (codePoint >> 6)));
+                token.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+        }
+        else if(codePoint < 0x10000){
+                token.push_back(static_cast<char>(0xE0 | (codePoint >> 12)));
+                token.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+                token.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+        }
+        else{
+                token.push_back(static_cast<char>(0xF0 | (codePoint >> 18)));
+                token.push_back(static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F)));
+                token.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+                token.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+        }
+}
+// Returns where the string value at the current position should be stored,
+// or NULL if the parser is not interested in it.
+std::string* StreamParser::valueTarget(){
+        const auto depth = frames.size();
+        if(depth == 0 || !frames.back().isObject){
+                return NULL;
+        }
+
+        const auto& key = frames.back().key;
+        if(depth == 1){
+                if(key == "continuation")
+                        return &continuation;
+                if(key == "errorMessage")
+                        return &errorMessage;
+                if(key == "errorId")
+                        return &errorId;
+                return NULL;
+        }
+        if(!inItem(depth)){
+                return NULL;
+        }
+
+        if(depth == 3){
+                if(key == "id")
+                        return &post.id;
+                if(key == "title")
+                        return &post.title;
+        }
+        else if(depth == 4){
+                if(frames[2].key == "summary" && key == "content")
+                        return &post.content;
+                if(frames[2].key == "origin" && key == "title")
+                        return &post.originTitle;
+        }
+        else if(depth == 5 && frames[2].key == "alternate" && !frames[3].isObject){
+                if(key == "href")
+                        return &alternateHref;
+                if(key == "type")
+                        return &alternateType;
+        }
+        else if(depth == 5 && frames[2].key == "categories" && !frames[3].isObject){
+                if(key == "id")
+                        return &categoryId;
+        }
+
+        return NULL;
+}
+long long* StreamParser::numberTarget(){
+        const auto depth = frames.size();
+        if(depth != 3 || !inItem(depth)){
+                return NULL;
+        }
+
+        const auto& key = frames.back().key;
+        if(key == "published")
+                return &post.published;
+        if(key == "crawled")
+                return &post.crawled;
+
+        return NULL;
+}
+// True if the frames up to depth 3 are root{"items": [ {entry} ]}.
+bool StreamParser::inItem(size_t depth) const{
+        return (depth >= 3) &&
+            frames[0].isObject && (frames[0].key == "items") &&
+            !frames[1].isObject &&
+            frames[2].isObject;
+}
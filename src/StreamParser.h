@@ -0,0 +1,52 @@
+#include <functional>
+#include <string>
+#include <vector>
+
+#ifndef _STREAM_PARSER_H_
+#define _STREAM_PARSER_H_
+
+#include "PostData.h"
+
+// Incremental parser for the streams/contents response. It is fed the body
+// chunk by chunk as curl receives it and hands out one PostData per entry
+// without ever building a Json::Value tree of the whole stream.
+class StreamParser{
+        public:
+                explicit StreamParser(PostCallback callback);
+                void feed(const char* data, size_t size);
+                void finish();
+                const std::string& getContinuation() const;
+                size_t getPostCount() const;
+        private:
+                enum class Lexer{ Value, String, Escape, Unicode, Literal };
+                struct Frame{
+                        bool isObject;
+                        bool expectingKey;
+                        std::string key;
+                };
+
+                PostCallback onPost;
+                Lexer lexer{Lexer::Value};
+                std::vector<Frame> frames;
+                std::string token;
+                bool capturing{}, readingKey{}, done{};
+                unsigned int unicodeDigits{}, unicodeValue{}, highSurrogate{};
+                size_t postCount{};
+
+                PostData post;
+                std::string alternateHref, alternateType, categoryId;
+                std::string continuation, errorMessage, errorId;
+
+                void beginContainer(bool isObject);
+                void endContainer(bool isObject);
+                void beginString();
+                void endString();
+                void endLiteral();
+                void appendCodePoint(unsigned int codePoint);
+                void flushSurrogate();
+                std::string* valueTarget();
+                long long* numberTarget();
+                bool inItem(size_t depth) const;
+};
+
+#endif
@@ -0,0 +1,33 @@
+#include <algorithm>
+#include <cwchar>
+
+#include "TextWidth.h"
+
+// Number of bytes of the UTF-8 text s that fit in the given number of
+// columns, which stops at control characters too. The columns they take are
+// added to width.
+size_t fittingBytes(const char* s, size_t length, size_t columns, size_t& width){
+        auto state = std::mbstate_t{};
+        size_t used = 0;
+        while(used < length){
+                wchar_t c;
+                auto charLength = std::mbrtowc(&c, s + used, length - used, &state);
+                auto charWidth = 1;
+                if((charLength == static_cast<size_t>(-1)) || (charLength == static_cast<size_t>(-2))){
+                        charLength = 1;
+                        state = std::mbstate_t{};
+                }
+                else{
+                        charLength = std::max<size_t>(charLength, 1);
+                        charWidth = wcwidth(c);
+                }
+
+                if((charWidth < 0) || (width + charWidth > columns)){
+                        break;
+                }
+                width += charWidth;
+                used += charLength;
+        }
+
+        return used;
+}
@@ -0,0 +1,8 @@
+#include <string>
+
+#ifndef _TEXT_WIDTH_H_
+#define _TEXT_WIDTH_H_
+
+size_t fittingBytes(const char* s, size_t length, size_t columns, size_t& width);
+
+#endif
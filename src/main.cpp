@@ -22,13 +22,16 @@ void atExitFunction(){
                 fs::remove_all(TMPDIR, errorCode);
         }
 
-        // Remove all under $HOME/.config/feednix except config.json and log.txt.
+        // Remove all under $HOME/.config/feednix except config.json, log.txt,
+        // journal.txt, which holds read-state changes not yet sent to Feedly,
+        // entries.db, the entries kept for the next session, and
+        // http-cache.json, the responses to revalidate on the next start.
         const auto home_path = fs::path{HOME_PATH};
         const auto config_dir = home_path / ".config" / "feednix";
         for(const auto& entry : fs::directory_iterator(config_dir)){
                 const auto& path = entry.path();
                 const auto& filename = path.filename();
-                if((filename != "config.json") && (filename != "log.txt")){
+                if((filename != "config.json") && (filename != "log.txt") && (filename != "journal.txt") && (filename != "entries.db") && (filename != "http-cache.json")){
                         fs::remove_all(path, errorCode);
                 }
         }